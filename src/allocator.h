@@ -14,6 +14,35 @@
 // maximum size of block that must be accommodated
 #define MAX_REQUEST_SIZE (1 << 30)
 
+// number of power-of-two size classes tracked by heap_stats
+#define HEAP_STATS_SIZE_CLASSES 32
+
+
+/* Type: heap_stats
+ * ----------------
+ * Snapshot of allocator metrics. Byte and block fields are computed by a
+ * walk of the heap when queried; the counters are plain adds on the
+ * allocation paths, reset by myinit. Size class i counts payloads in
+ * [2^i, 2^(i+1)).  Allocators that cannot observe an event leave its
+ * counter at zero.
+ */
+typedef struct {
+    size_t heap_bytes;              // bytes of the segment in use by the heap
+    size_t live_bytes;              // payload bytes in used blocks
+    size_t free_bytes;              // payload bytes in free blocks
+    size_t free_blocks;             // number of free blocks
+    size_t largest_free_block;      // payload bytes of the largest free block
+
+    unsigned long alloc_count[HEAP_STATS_SIZE_CLASSES];
+    unsigned long free_count[HEAP_STATS_SIZE_CLASSES];
+
+    unsigned long realloc_inplace_hits;     // realloc served without moving
+    unsigned long realloc_inplace_misses;   // realloc that had to move
+    unsigned long realloc_copy_bytes;       // payload bytes copied by those
+    unsigned long coalesce_count;           // free blocks merged into another
+    unsigned long split_count;              // free blocks split on reuse
+} heap_stats;
+
 
 
 /* Function: myinit
@@ -57,4 +86,25 @@ void myfree(void *ptr);
  */
 bool validate_heap(void);
 
+
+/* Function: heap_get_stats
+ * ------------------------
+ * Fills in stats with the current allocator metrics.
+ */
+void heap_get_stats(heap_stats *stats);
+
+
+/* Functions: heap_snapshot, heap_restore
+ * --------------------------------------
+ * heap_snapshot writes the heap in use and the allocator's state to the
+ * file at path. heap_restore brings a snapshot back into the segment given
+ * to the last myinit, which must have the address and size it had when the
+ * snapshot was taken; the heap is mapped copy-on-write from the file, so
+ * restoring a large warmed-up heap costs little until it is written. Both
+ * return false on error, after which heap_restore leaves the heap unusable
+ * until the next myinit.
+ */
+bool heap_snapshot(const char *path);
+bool heap_restore(const char *path);
+
 #endif
@@ -0,0 +1,20 @@
+/* File: backend.c
+ * ---------------
+ * Entry point linked into every allocator shared object. Each object is
+ * linked with -Bsymbolic, so the table refers to that object's own
+ * mymalloc and friends even when several allocators are loaded at once.
+ */
+
+#include "allocator.h"
+#include "backend.h"
+
+const allocator_backend *allocator_backend_entry(void) {
+    static const allocator_backend backend = {
+        .init = myinit,
+        .malloc = mymalloc,
+        .realloc = myrealloc,
+        .free = myfree,
+        .validate = validate_heap,
+    };
+    return &backend;
+}
@@ -0,0 +1,33 @@
+/* File: backend.h
+ * ---------------
+ * Interface for loading allocators as shared objects. Each lib<name>.so
+ * built from an allocator and backend.c exports allocator_backend_entry,
+ * which returns a table of that allocator's functions, so one program can
+ * dlopen several allocators and call each through its own table.
+ */
+
+#ifndef _BACKEND_H_
+#define _BACKEND_H_
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+// name of the entry point each backend shared object exports
+#define ALLOCATOR_BACKEND_ENTRY "allocator_backend_entry"
+
+typedef struct {
+    bool (*init)(void *segment_start, size_t segment_size);
+    void *(*malloc)(size_t size);
+    void *(*realloc)(void *ptr, size_t new_size);
+    void (*free)(void *ptr);
+    bool (*validate)(void);
+} allocator_backend;
+
+
+/* Function: allocator_backend_entry
+ * ---------------------------------
+ * Returns the function table of the allocator in this shared object.
+ */
+const allocator_backend *allocator_backend_entry(void);
+
+
+#endif
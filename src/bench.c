@@ -0,0 +1,555 @@
+/*
+ * File: bench.c
+ * -------------
+ * Benchmarks an allocator on a set of scripts and records or checks a
+ * baseline, so that a change that slows the allocator down or wastes more
+ * of the heap is caught as soon as it is made.
+ *
+ *      bench_explicit -w -b baseline.json script...     record a baseline
+ *      bench_explicit -b baseline.json script...        check against it
+ *      bench_explicit -s -b baseline.json script...     speedup over it
+ *
+ * Each script is measured in -n runs (default 5). A run replays the script
+ * on a fresh heap, repeatedly for short scripts, counting user-space
+ * instructions (when perf counters are available) and timing the requests;
+ * utilization is computed the way the test harness does.
+ * The baseline keeps, per script, the median and the median absolute
+ * deviation (MAD) of instructions and ops/sec, and the utilization.
+ *
+ * A check flags a script when its median moves against it by more than
+ * both a relative tolerance and NOISE_MADS scaled MADs of the two runs
+ * combined, or when its utilization drops by a percentage point or more.
+ * The exit status is the number of regressions. With -s, each script's
+ * ops/sec is reported as a speedup over the baseline instead, e.g. to
+ * compare two builds of an allocator, and the exit status is 0 once every
+ * script has run.
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocator.h"
+#include "perf_counters.h"
+#include "script.h"
+#include "segment.h"
+
+
+/* TYPE DECLARATIONS */
+
+
+// figures for one script, measured now or read from the baseline
+typedef struct {
+    char name[128];
+    double instructions;        // median, -1 if counters were unavailable
+    double instructions_mad;
+    double ops_per_sec;         // median
+    double ops_per_sec_mad;
+    int util;                   // percent, identical on every run
+} bench_result_t;
+
+
+/* CONSTANTS */
+
+
+const long HEAP_SIZE = 1L << 32;
+
+const int DEFAULT_RUNS = 5;
+
+// each run replays the script until this much time has been measured
+const double MIN_RUN_SECONDS = 0.05;
+
+// default tolerated ops/sec slowdown, percent of the baseline median
+const double DEFAULT_TOLERANCE = 5.0;
+
+// tolerated instruction count increase, percent of the baseline median
+const double INSTRUCTION_TOLERANCE = 1.0;
+
+// a change must also exceed this many scaled MADs to count
+const double NOISE_MADS = 3.0;
+
+// scales a MAD to a standard deviation for normally distributed noise
+const double MAD_TO_SIGMA = 1.4826;
+
+const int MAX_BASELINE_LINE_LEN = 1024;
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static bool bench_script(const char *path, int runs, bench_result_t *result);
+static bool measure_utilization(script_t *script, int *util);
+static bool time_run(script_t *script, perf_counters *counters, bool counting,
+    double *instructions, double *ops_per_sec);
+static bool replay_pass(script_t *script, perf_counters *counters, bool counting,
+    perf_totals *totals, double *seconds);
+static double median(double *values, int n);
+static double median_deviation(double *values, int n, double med);
+static int compare_doubles(const void *a, const void *b);
+static void write_baseline(const char *path, const char *allocator, int runs,
+    bench_result_t *results, int num_results);
+static int read_baseline(const char *path, bench_result_t **results);
+static int check_result(bench_result_t *now, bench_result_t *baseline, double tolerance);
+static bool worse_than(double now, double base, double now_mad, double base_mad,
+    double tolerance, int direction);
+static double report_speedup(bench_result_t *now, bench_result_t *baseline);
+
+
+/* Function: main
+ * --------------
+ * Parses the command line, benchmarks every script, then either writes the
+ * baseline (-w) or compares against it. Options:
+ *  -b PATH baseline file (required)
+ *  -w      write the baseline instead of checking against it
+ *  -s      report speedups over the baseline instead of regressions
+ *  -n N    runs per script (default 5)
+ *  -t PCT  tolerated ops/sec slowdown in percent (default 5)
+ */
+int main(int argc, char *argv[]) {
+    int c;
+    const char *baseline_path = NULL;
+    bool write = false;
+    bool speedup = false;
+    int runs = DEFAULT_RUNS;
+    double tolerance = DEFAULT_TOLERANCE;
+    while ((c = getopt(argc, argv, "b:wsn:t:")) != EOF) {
+        if (c == 'b') {
+            baseline_path = optarg;
+        } else if (c == 'w') {
+            write = true;
+        } else if (c == 's') {
+            speedup = true;
+        } else if (c == 'n') {
+            runs = atoi(optarg);
+            if (runs <= 0) {
+                error(1, 0, "Number of runs must be positive.");
+            }
+        } else if (c == 't') {
+            tolerance = atof(optarg);
+            if (tolerance < 0) {
+                error(1, 0, "Tolerance must not be negative.");
+            }
+        }
+    }
+    if (baseline_path == NULL || optind >= argc) {
+        error(1, 0, "Usage: %s [-w | -s] [-n runs] [-t pct] -b baseline.json script...", argv[0]);
+    }
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    // bench_<allocator> names the allocator this binary was built with
+    const char *allocator = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+    if (strncmp(allocator, "bench_", strlen("bench_")) == 0) {
+        allocator += strlen("bench_");
+    }
+
+    int num_scripts = argc - optind;
+    bench_result_t *results = calloc(num_scripts, sizeof(bench_result_t));
+    if (results == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    printf("%-28s %14s %10s %12s %10s %5s\n", "script", "instructions", "mad",
+        "ops/sec", "mad", "util");
+    int nfailures = 0;
+    for (int i = 0; i < num_scripts; i++) {
+        bench_result_t *result = &results[i];
+        if (!bench_script(argv[optind + i], runs, result)) {
+            printf("%-28s failed\n", result->name);
+            nfailures++;
+            continue;
+        }
+        if (result->instructions < 0) {
+            printf("%-28s %14s %10s", result->name, "n/a", "n/a");
+        } else {
+            printf("%-28s %14.0f %10.0f", result->name, result->instructions,
+                result->instructions_mad);
+        }
+        printf(" %12.0f %10.0f %4d%%\n", result->ops_per_sec, result->ops_per_sec_mad,
+            result->util);
+    }
+    if (nfailures > 0) {
+        error(0, 0, "%d script(s) failed; run the test harness on them for details.",
+            nfailures);
+        free(results);
+        return nfailures;
+    }
+
+    if (write) {
+        write_baseline(baseline_path, allocator, runs, results, num_scripts);
+        printf("\nBaseline written to %s\n", baseline_path);
+        free(results);
+        return 0;
+    }
+
+    bench_result_t *baseline = NULL;
+    int num_baseline = read_baseline(baseline_path, &baseline);
+    int nregressions = 0, ncompared = 0;
+    double log_speedups = 0;
+    printf("\n");
+    for (int i = 0; i < num_scripts; i++) {
+        bench_result_t *base = NULL;
+        for (int j = 0; j < num_baseline; j++) {
+            if (strcmp(baseline[j].name, results[i].name) == 0) {
+                base = &baseline[j];
+            }
+        }
+        if (base == NULL) {
+            printf("%s: not in baseline, skipped\n", results[i].name);
+        } else if (speedup) {
+            log_speedups += log(report_speedup(&results[i], base));
+            ncompared++;
+        } else {
+            nregressions += check_result(&results[i], base, tolerance);
+        }
+    }
+    if (speedup && ncompared > 0) {
+        printf("\n%.2fx ops/sec over %s, geometric mean of %d script(s)\n",
+            exp(log_speedups / ncompared), baseline_path, ncompared);
+    } else if (!speedup) {
+        printf("\n%d regression(s) against %s\n", nregressions, baseline_path);
+    }
+
+    free(baseline);
+    free(results);
+    return speedup ? 0 : nregressions;
+}
+
+/* Function: bench_script
+ * ----------------------
+ * Measures the script's utilization, then times it `runs` times and fills
+ * in result with the medians and MADs of the runs. Returns false if the
+ * allocator failed a request.
+ */
+static bool bench_script(const char *path, int runs, bench_result_t *result) {
+    script_t script = parse_script(path);
+    snprintf(result->name, sizeof(result->name), "%s", script.name);
+
+    perf_counters counters;
+    bool counting = perf_counters_open(&counters) &&
+        perf_counters_available(&counters, PERF_INSTRUCTIONS);
+
+    double *instructions = malloc(runs * sizeof(double));
+    double *ops_per_sec = malloc(runs * sizeof(double));
+    if (instructions == NULL || ops_per_sec == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    bool success = measure_utilization(&script, &result->util);
+    for (int run = 0; run < runs && success; run++) {
+        success = time_run(&script, &counters, counting, &instructions[run],
+            &ops_per_sec[run]);
+    }
+
+    if (success) {
+        result->ops_per_sec = median(ops_per_sec, runs);
+        result->ops_per_sec_mad = median_deviation(ops_per_sec, runs, result->ops_per_sec);
+        bool counted = counting;
+        for (int run = 0; run < runs; run++) {
+            counted = counted && instructions[run] >= 0;
+        }
+        if (counted) {
+            result->instructions = median(instructions, runs);
+            result->instructions_mad = median_deviation(instructions, runs,
+                result->instructions);
+        } else {
+            result->instructions = -1;
+            result->instructions_mad = 0;
+        }
+    }
+
+    perf_counters_close(&counters);
+    free(instructions);
+    free(ops_per_sec);
+    free(script.ops);
+    free(script.blocks);
+    return success;
+}
+
+/* Function: measure_utilization
+ * -----------------------------
+ * Replays the script once, untimed, and computes its utilization the way
+ * the test harness does: peak payload over the extent of the heap used.
+ */
+static bool measure_utilization(script_t *script, int *util) {
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        return false;
+    }
+    memset(script->blocks, 0, script->num_ids * sizeof(block_t));
+
+    char *heap_end = heap_segment_start();
+    size_t cur_size = 0, peak_size = 0;
+    for (int req = 0; req < script->num_ops; req++) {
+        request_t *request = &script->ops[req];
+        block_t *block = &script->blocks[request->id];
+        cur_size -= block->size;
+        if (request->op == ALLOC) {
+            block->ptr = mymalloc(request->size);
+        } else if (request->op == REALLOC) {
+            block->ptr = myrealloc(block->ptr, request->size);
+        } else {
+            myfree(block->ptr);
+            *block = (block_t){.ptr = NULL, .size = 0};
+            continue;
+        }
+        if (block->ptr == NULL && request->size != 0) {
+            return false;
+        }
+        block->size = request->size;
+        cur_size += request->size;
+        if (cur_size > peak_size) {
+            peak_size = cur_size;
+        }
+        if ((char *)block->ptr + block->size > heap_end) {
+            heap_end = (char *)block->ptr + block->size;
+        }
+    }
+    size_t used_segment = heap_end - (char *)heap_segment_start();
+    *util = used_segment > 0 ? (100 * peak_size) / used_segment : 0;
+    return true;
+}
+
+/* Function: time_run
+ * ------------------
+ * One measured run: replays the script on a fresh heap as many times as it
+ * takes to fill MIN_RUN_SECONDS, so short scripts are not lost in timer
+ * noise. Reports instructions per replay, or -1 if the counters never ran,
+ * and requests per second.
+ */
+static bool time_run(script_t *script, perf_counters *counters, bool counting,
+    double *instructions, double *ops_per_sec) {
+
+    perf_totals totals = {0};
+    double seconds = 0;
+    int passes = 0;
+    while (seconds < MIN_RUN_SECONDS) {
+        if (!replay_pass(script, counters, counting, &totals, &seconds)) {
+            return false;
+        }
+        passes++;
+    }
+    double counted;
+    if (counting && perf_totals_value(&totals, PERF_INSTRUCTIONS, &counted)) {
+        *instructions = counted / passes;
+    } else {
+        *instructions = -1;
+    }
+    *ops_per_sec = (double)passes * script->num_ops / seconds;
+    return true;
+}
+
+/* Function: replay_pass
+ * ---------------------
+ * Replays the script once on a fresh heap, with the counters running and
+ * the clock read around the request loop only, adding to totals and
+ * *seconds. The segment left by measure_utilization is reused, so pages
+ * are already faulted in and the kernel stays out of the timing. Payloads
+ * are not touched: correctness is the test harness's job, and the loop
+ * here should be as close to nothing but allocator calls as possible.
+ */
+static bool replay_pass(script_t *script, perf_counters *counters, bool counting,
+    perf_totals *totals, double *seconds) {
+
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        return false;
+    }
+    memset(script->blocks, 0, script->num_ids * sizeof(block_t));
+
+    struct timespec start, end;
+    bool success = true;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (counting) {
+        perf_counters_start(counters);
+    }
+    for (int req = 0; req < script->num_ops; req++) {
+        request_t *request = &script->ops[req];
+        block_t *block = &script->blocks[request->id];
+        if (request->op == ALLOC) {
+            block->ptr = mymalloc(request->size);
+        } else if (request->op == REALLOC) {
+            block->ptr = myrealloc(block->ptr, request->size);
+        } else {
+            myfree(block->ptr);
+            block->ptr = NULL;
+            continue;
+        }
+        if (block->ptr == NULL && request->size != 0) {
+            success = false;
+            break;
+        }
+    }
+    if (counting) {
+        perf_counters_stop(counters, totals);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return success;
+}
+
+/* Function: median
+ * ----------------
+ * Returns the median of n values, sorting them in place.
+ */
+static double median(double *values, int n) {
+    qsort(values, n, sizeof(double), compare_doubles);
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+/* Function: median_deviation
+ * --------------------------
+ * Returns the median absolute deviation of n values from med.
+ */
+static double median_deviation(double *values, int n, double med) {
+    double deviations[n];
+    for (int i = 0; i < n; i++) {
+        deviations[i] = fabs(values[i] - med);
+    }
+    return median(deviations, n);
+}
+
+/* Function: compare_doubles
+ * -------------------------
+ * qsort comparison for ascending doubles.
+ */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function: write_baseline
+ * ------------------------
+ * Writes the results as JSON, one script object per line so that
+ * read_baseline can read it back without a JSON library.
+ */
+static void write_baseline(const char *path, const char *allocator, int runs,
+    bench_result_t *results, int num_results) {
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        error(1, errno, "Could not open baseline file \"%s\"", path);
+    }
+    fprintf(fp, "{\n  \"allocator\": \"%s\",\n  \"runs\": %d,\n  \"scripts\": [\n",
+        allocator, runs);
+    for (int i = 0; i < num_results; i++) {
+        bench_result_t *result = &results[i];
+        fprintf(fp, "    {\"script\": \"%s\", \"instructions\": %.0f, "
+            "\"instructions_mad\": %.0f, \"ops_per_sec\": %.0f, \"ops_per_sec_mad\": %.0f, "
+            "\"utilization\": %d}%s\n", result->name, result->instructions,
+            result->instructions_mad, result->ops_per_sec, result->ops_per_sec_mad,
+            result->util, i + 1 < num_results ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    if (fclose(fp) != 0) {
+        error(1, errno, "Could not write baseline file \"%s\"", path);
+    }
+}
+
+/* Function: read_baseline
+ * -----------------------
+ * Reads a baseline written by write_baseline into a new array stored in
+ * *results. Returns the number of scripts read.
+ */
+static int read_baseline(const char *path, bench_result_t **results) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        error(1, errno, "Could not open baseline file \"%s\"; record one with -w", path);
+    }
+
+    int count = 0, capacity = 0;
+    *results = NULL;
+    char line[MAX_BASELINE_LINE_LEN];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        bench_result_t result;
+        int nscanned = sscanf(line, " {\"script\": \"%127[^\"]\", \"instructions\": %lf, "
+            "\"instructions_mad\": %lf, \"ops_per_sec\": %lf, \"ops_per_sec_mad\": %lf, "
+            "\"utilization\": %d}", result.name, &result.instructions,
+            &result.instructions_mad, &result.ops_per_sec, &result.ops_per_sec_mad,
+            &result.util);
+        if (nscanned != 6) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 32;
+            *results = realloc(*results, capacity * sizeof(bench_result_t));
+            if (*results == NULL) {
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+        }
+        (*results)[count++] = result;
+    }
+    fclose(fp);
+    return count;
+}
+
+/* Function: check_result
+ * ----------------------
+ * Compares one script's results with its baseline and prints a line for
+ * each regression found. Returns the number of regressions.
+ */
+static int check_result(bench_result_t *now, bench_result_t *baseline, double tolerance) {
+    int nregressions = 0;
+
+    if (now->instructions >= 0 && baseline->instructions >= 0 &&
+        worse_than(now->instructions, baseline->instructions, now->instructions_mad,
+            baseline->instructions_mad, INSTRUCTION_TOLERANCE, 1)) {
+        printf("%s: REGRESSION instructions %.0f -> %.0f (%+.1f%%)\n", now->name,
+            baseline->instructions, now->instructions,
+            100 * (now->instructions - baseline->instructions) / baseline->instructions);
+        nregressions++;
+    }
+    if (worse_than(now->ops_per_sec, baseline->ops_per_sec, now->ops_per_sec_mad,
+            baseline->ops_per_sec_mad, tolerance, -1)) {
+        printf("%s: REGRESSION ops/sec %.0f -> %.0f (%+.1f%%)\n", now->name,
+            baseline->ops_per_sec, now->ops_per_sec,
+            100 * (now->ops_per_sec - baseline->ops_per_sec) / baseline->ops_per_sec);
+        nregressions++;
+    }
+    if (now->util < baseline->util) {
+        printf("%s: REGRESSION utilization %d%% -> %d%%\n", now->name, baseline->util,
+            now->util);
+        nregressions++;
+    }
+    if (nregressions == 0) {
+        printf("%s: ok\n", now->name);
+    }
+    return nregressions;
+}
+
+/* Function: worse_than
+ * --------------------
+ * Returns whether now differs from base in the bad direction (+1 if larger
+ * is worse, -1 if smaller is worse) by more than tolerance percent of base
+ * and by more than NOISE_MADS scaled MADs of the two measurements.
+ */
+static bool worse_than(double now, double base, double now_mad, double base_mad,
+    double tolerance, int direction) {
+
+    double change = direction * (now - base);
+    double noise = NOISE_MADS * MAD_TO_SIGMA * sqrt(now_mad * now_mad + base_mad * base_mad);
+    return change > tolerance / 100 * base && change > noise;
+}
+
+/* Function: report_speedup
+ * ------------------------
+ * Prints one script's ops/sec against its baseline as a speedup, with the
+ * change in instructions when both runs counted them. Returns the speedup.
+ */
+static double report_speedup(bench_result_t *now, bench_result_t *baseline) {
+    double speedup = now->ops_per_sec / baseline->ops_per_sec;
+    printf("%s: %.2fx ops/sec %.0f -> %.0f", now->name, speedup, baseline->ops_per_sec,
+        now->ops_per_sec);
+    if (now->instructions >= 0 && baseline->instructions >= 0) {
+        printf(", instructions %+.1f%%",
+            100 * (now->instructions - baseline->instructions) / baseline->instructions);
+    }
+    printf("\n");
+    return speedup;
+}
@@ -2,9 +2,13 @@
  * ------------
  * A "bump" allocator that allocates memory only by tacking on 
  * at the end of the heap.  Free is a no-op: blocks are never coalesced
- * or reused.  Realloc is implemented using malloc/memcpy/free. Operations
- * are fast, but utilization is very poor. It is also missing
- * attention to robustness.
+ * or reused.  Realloc resizes the most recent block in place, and
+ * otherwise falls back to malloc/memcpy/free. Operations are fast, but
+ * utilization is very poor unless the heap is used as a region: a client
+ * takes a bump_mark() at the start of a scope and calls bump_rollback()
+ * at the end, which releases everything allocated since in O(1).
+ * Scopes nest: the outstanding marks form a stack, and rolling back to one
+ * pops the marks above it, so a mark from a closed scope is rejected.
  *
  * This shows the very simplest of approaches; there are better options!
  */
@@ -13,12 +17,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include "allocator.h"
+#include "bump.h"
 #include "debug_break.h"
+#include "segment.h"
 
 static void *segment_start;
 static size_t segment_size;
 static size_t nused;
 
+// Offset of the most recent block, the only one that can be resized in place;
+// a mark taken since pins it, as growing it would cross the mark
+static size_t last_offset;
+static bool has_last;
+
+// Serials of the outstanding marks, innermost last
+static unsigned long marks[BUMP_MAX_MARKS];
+static int nmarks;
+static unsigned long next_serial;
+
+// Allocation counters reported by heap_get_stats
+static heap_stats stats;
+
 
 /* Function: roundup
  * -----------------
@@ -29,6 +48,19 @@ size_t roundup(size_t sz, size_t mult) {
     return (sz + mult - 1) & ~(mult - 1);
 }
 
+/* Function: size_class
+ * ---------------------
+ * This function returns the heap_stats size class of the given size,
+ * which is the position of its highest set bit.
+ */
+size_t size_class(size_t sz) {
+    if (sz == 0) {
+        return 0;
+    }
+    size_t class = 63 - __builtin_clzl(sz);
+    return class < HEAP_STATS_SIZE_CLASSES ? class : HEAP_STATS_SIZE_CLASSES - 1;
+}
+
 /* Function: myinit
  * ----------------
  * This function initializes our global variables based on the specified
@@ -38,6 +70,10 @@ bool myinit(void *start, size_t size) {
     segment_start = start;
     segment_size = size;
     nused = 0;
+    has_last = false;
+    nmarks = 0;
+    next_serial = 1;
+    memset(&stats, 0, sizeof(stats));
     return true;
 }
 
@@ -53,6 +89,9 @@ void *mymalloc(size_t requestedsz) {
         return NULL;
     }
     void *ptr = (char *)segment_start + nused;
+    stats.alloc_count[size_class(requestedsz)]++;
+    last_offset = nused;
+    has_last = true;
     nused += needed;
     return ptr;
 }
@@ -66,16 +105,136 @@ void myfree(void *ptr) {}
 /* Function: realloc
  * -----------------
  * This function satisfies requests for resizing previously-allocated memory
- * blocks by allocating a new block of the requested size and moving the
- * existing contents to that region.  It's not particularly efficient.
+ * blocks.  If the block is the most recent allocation and no mark was taken
+ * since, it sits at the top of the heap and can grow or shrink in place by
+ * just moving nused.  Otherwise
+ * a new block of the requested size is allocated and the existing contents
+ * are moved to that region.  Blocks carry no header, so the old size is not
+ * known; the copy is bounded by the bytes between the old block and the
+ * top of the heap, which never reads past memory we handed out.
  */
 void *myrealloc(void *oldptr, size_t newsz) {
+    if (oldptr == NULL) {
+        return mymalloc(newsz);
+    }
+
+    size_t offset = (char *)oldptr - (char *)segment_start;
+    if (has_last && offset == last_offset) {
+        size_t needed = roundup(newsz, ALIGNMENT);
+        if (needed + offset > segment_size) {
+            return NULL;
+        }
+        nused = offset + needed;
+        stats.realloc_inplace_hits++;
+        return oldptr;
+    }
+
+    stats.realloc_inplace_misses++;
+    size_t available = nused - offset;
     void *newptr = mymalloc(newsz);
-    memcpy(newptr, oldptr, newsz);
+    if (newptr == NULL) {
+        return NULL;
+    }
+    memcpy(newptr, oldptr, newsz < available ? newsz : available);
+    stats.realloc_copy_bytes += newsz < available ? newsz : available;
     myfree(oldptr);
     return newptr;
 }
 
+/* Function: bump_mark
+ * -------------------
+ * This function pushes a new mark for the current top of the heap, to be
+ * passed later to bump_rollback.  The most recent block can no longer be
+ * resized in place, since it lies below the mark.  When the mark stack is
+ * full, the mark returned has serial 0 and is rejected by bump_rollback.
+ */
+bump_mark_t bump_mark() {
+    if (nmarks == BUMP_MAX_MARKS) {
+        return (bump_mark_t){.offset = nused, .serial = 0};
+    }
+    bump_mark_t mark = {.offset = nused, .serial = next_serial++};
+    marks[nmarks++] = mark.serial;
+    has_last = false;
+    return mark;
+}
+
+/* Function: bump_rollback
+ * -----------------------
+ * This function releases every block allocated since the given mark was
+ * taken, by moving the top of the heap back to it, and pops the marks taken
+ * since.  A mark that is no longer on the stack (e.g. an inner scope's mark
+ * after its outer scope was already rolled back) is rejected and false is
+ * returned.
+ */
+bool bump_rollback(bump_mark_t mark) {
+    int i = nmarks - 1;
+    while (i >= 0 && marks[i] > mark.serial) {
+        i--;
+    }
+    if (i < 0 || marks[i] != mark.serial) {
+        return false;
+    }
+    nmarks = i + 1;
+    nused = mark.offset;
+    has_last = false;
+    return true;
+}
+
+/* Function: heap_get_stats
+ * -------------------------
+ * This function reports the allocator counters.  Nothing is ever freed
+ * (short of a rollback), so all heap bytes count as live and frees are
+ * not attributed to a size class.
+ */
+void heap_get_stats(heap_stats *out) {
+    *out = stats;
+    out->heap_bytes = nused;
+    out->live_bytes = nused;
+}
+
+/* Type: bump_state
+ * ----------------
+ * The globals saved by heap_snapshot.
+ */
+typedef struct {
+    size_t nused;
+    size_t last_offset;
+    bool has_last;
+    unsigned long marks[BUMP_MAX_MARKS];
+    int nmarks;
+    unsigned long next_serial;
+    heap_stats stats;
+} bump_state;
+
+/* Functions: heap_snapshot, heap_restore
+ * --------------------------------------
+ * These functions save and restore the used bytes of the heap and the
+ * globals above.
+ */
+bool heap_snapshot(const char *path) {
+    bump_state state = {.nused = nused, .last_offset = last_offset, .has_last = has_last,
+        .nmarks = nmarks, .next_serial = next_serial, .stats = stats};
+    memcpy(state.marks, marks, sizeof(marks));
+    return write_heap_snapshot(path, segment_start, segment_size, nused, &state, sizeof(state));
+}
+
+bool heap_restore(const char *path) {
+    bump_state state;
+    size_t state_bytes = sizeof(state);
+    if (!map_heap_snapshot(path, segment_start, segment_size, &state, &state_bytes) ||
+        state_bytes != sizeof(state)) {
+        return false;
+    }
+    nused = state.nused;
+    last_offset = state.last_offset;
+    has_last = state.has_last;
+    memcpy(marks, state.marks, sizeof(marks));
+    nmarks = state.nmarks;
+    next_serial = state.next_serial;
+    stats = state.stats;
+    return true;
+}
+
 /* Function: validate_heap
  * -----------------------
  * This function checks for potential errors/inconsistencies in the heap data
@@ -0,0 +1,42 @@
+/* File: bump.h
+ * ------------
+ * Region interface for the bump allocator. A mark records the top of the
+ * heap; rolling back to it releases, in O(1), every block allocated since.
+ * Marks can be nested, up to BUMP_MAX_MARKS deep: rolling back to an outer
+ * mark also discards all blocks from inner scopes, and the inner marks
+ * themselves.
+ */
+
+#ifndef _BUMP_H_
+#define _BUMP_H_
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+// deepest nesting of outstanding marks
+#define BUMP_MAX_MARKS 64
+
+// serial 0 is never a valid mark
+typedef struct {
+    size_t offset;
+    unsigned long serial;
+} bump_mark_t;
+
+
+/* Function: bump_mark
+ * -------------------
+ * Returns a mark for the current top of the heap. If BUMP_MAX_MARKS marks
+ * are already outstanding, the mark returned is not valid.
+ */
+bump_mark_t bump_mark();
+
+
+/* Function: bump_rollback
+ * -----------------------
+ * Releases all blocks allocated since mark was taken, and the marks taken
+ * since; the mark itself stays valid. Returns false, changing nothing, if
+ * the mark is no longer valid (the heap was rolled back to an earlier one).
+ */
+bool bump_rollback(bump_mark_t mark);
+
+
+#endif
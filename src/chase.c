@@ -0,0 +1,172 @@
+/*
+ * File: chase.c
+ * -------------
+ * Pointer-chasing microbenchmark over objects from the explicit allocator,
+ * to see what cache-line placement is worth. Objects are allocated between
+ * fillers of random size, so they land at every offset within a line, and
+ * are linked into one random cycle. Each hop reads the whole object, so an
+ * object that straddles two cache lines costs two misses instead of one.
+ *
+ *      chase_explicit [-n objects] [-s size] [-i]
+ *
+ * -i allocates the objects with mymalloc_isolated. Build explicit without
+ * CACHE_LINE_PLACEMENT for the figures without placement.
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "allocator.h"
+#include "placement.h"
+#include "segment.h"
+
+
+/* CONSTANTS */
+
+
+const long HEAP_SIZE = 1L << 32;
+
+const int DEFAULT_OBJECTS = 1 << 14;
+
+const int DEFAULT_SIZE = 48;
+
+const int MAX_FILLER_SIZE = 120;
+
+const int HOPS_PER_OBJECT = 4;
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static void **allocate_objects(int num_objects, size_t size, bool isolated);
+static void link_cycle(void **objects, int num_objects);
+static uintptr_t chase(void *start, long hops, size_t size);
+
+
+/* Function: main
+ * --------------
+ * Allocates the objects, reports how many straddle a cache line and how
+ * much heap each takes, and times the chase.
+ */
+int main(int argc, char *argv[]) {
+    int num_objects = DEFAULT_OBJECTS;
+    size_t size = DEFAULT_SIZE;
+    bool isolated = false;
+    int c;
+    while ((c = getopt(argc, argv, "n:s:i")) != EOF) {
+        if (c == 'n') {
+            num_objects = atoi(optarg);
+        } else if (c == 's') {
+            size = atoi(optarg);
+        } else if (c == 'i') {
+            isolated = true;
+        }
+    }
+    if (num_objects < 2 || size < sizeof(void *)) {
+        error(1, 0, "Usage: %s [-n objects (at least 2)] [-s size (at least %zu)] [-i]",
+            argv[0], sizeof(void *));
+    }
+
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        error(1, 0, "myinit() returned false");
+    }
+    void **objects = allocate_objects(num_objects, size, isolated);
+
+    int straddling = 0;
+    for (int i = 0; i < num_objects; i++) {
+        if ((uintptr_t)objects[i] % CACHE_LINE_BYTES + size > CACHE_LINE_BYTES) {
+            straddling++;
+        }
+    }
+    heap_stats stats;
+    heap_get_stats(&stats);
+
+    link_cycle(objects, num_objects);
+    long hops = (long)num_objects * HOPS_PER_OBJECT;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uintptr_t sum = chase(objects[0], hops, size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+    printf("%d objects of %zu bytes%s: %.1f%% straddle a cache line, "
+        "%.1f heap bytes per object and filler, %.1f ns per hop (%lx)\n",
+        num_objects, size, isolated ? " (isolated)" : "", 100.0 * straddling / num_objects,
+        (double)stats.heap_bytes / num_objects, ns / hops, (unsigned long)(sum & 0xf));
+    free(objects);
+    return 0;
+}
+
+/* Function: allocate_objects
+ * --------------------------
+ * Allocates num_objects objects of size bytes, each after a filler of
+ * random size that stays allocated. Returns the objects in address order.
+ */
+static void **allocate_objects(int num_objects, size_t size, bool isolated) {
+    void **objects = malloc(num_objects * sizeof(void *));
+    if (objects == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    srand(1);
+    for (int i = 0; i < num_objects; i++) {
+        if (mymalloc(1 + rand() % MAX_FILLER_SIZE) == NULL) {
+            error(1, 0, "Heap exhausted after %d objects.", i);
+        }
+        objects[i] = isolated ? mymalloc_isolated(size) : mymalloc(size);
+        if (objects[i] == NULL) {
+            error(1, 0, "Heap exhausted after %d objects.", i);
+        }
+        for (size_t word = 1; word < size / sizeof(uintptr_t); word++) {
+            ((uintptr_t *)objects[i])[word] = word;
+        }
+    }
+    return objects;
+}
+
+/* Function: link_cycle
+ * --------------------
+ * Links the objects into a single cycle in random order, through the
+ * first word of each.
+ */
+static void link_cycle(void **objects, int num_objects) {
+    int *order = malloc(num_objects * sizeof(int));
+    if (order == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int i = 0; i < num_objects; i++) {
+        order[i] = i;
+    }
+    for (int i = num_objects - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    for (int i = 0; i < num_objects; i++) {
+        *(void **)objects[order[i]] = objects[order[(i + 1) % num_objects]];
+    }
+    free(order);
+}
+
+/* Function: chase
+ * ---------------
+ * Follows the cycle for hops hops, summing every word of each object so
+ * that all of its cache lines are read. Returns the sum.
+ */
+static uintptr_t chase(void *start, long hops, size_t size) {
+    uintptr_t sum = 0;
+    uintptr_t *object = start;
+    size_t words = size / sizeof(uintptr_t);
+    for (long hop = 0; hop < hops; hop++) {
+        for (size_t word = 1; word < words; word++) {
+            sum += object[word];
+        }
+        object = (uintptr_t *)object[0];
+    }
+    return sum;
+}
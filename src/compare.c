@@ -0,0 +1,292 @@
+/*
+ * File: compare.c
+ * ---------------
+ * Runs scripts against several allocators loaded at run time, and prints
+ * a side-by-side table of utilization, throughput and tail latency.
+ *
+ *      test_compare --alloc=explicit,implicit,bump script...
+ *
+ * Each name is loaded from ./lib<name>.so (a name containing '/' is used
+ * as the path itself). Every script is replayed against every backend on a
+ * fresh heap segment; payloads are filled and checked as in the test
+ * harness, but only the allocator calls themselves are timed.
+ */
+
+#include <dlfcn.h>
+#include <error.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocator.h"
+#include "backend.h"
+#include "script.h"
+#include "segment.h"
+
+
+/* TYPE DECLARATIONS */
+
+
+// a loaded allocator
+typedef struct {
+    char name[64];
+    void *handle;
+    const allocator_backend *backend;
+} loaded_backend_t;
+
+// figures for one script against one backend
+typedef struct {
+    bool success;
+    int util;               // peak payload / segment used, in percent
+    double ops_per_sec;     // requests per second of allocator time
+    long p99_ns;            // 99th percentile request latency
+} run_result_t;
+
+
+/* CONSTANTS */
+
+
+const long HEAP_SIZE = 1L << 32;
+
+const int MAX_BACKENDS = 16;
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static int load_backends(char *list, loaded_backend_t *backends);
+static run_result_t run_script(const allocator_backend *backend, script_t *script);
+static bool check_payload(void *ptr, size_t size, int id);
+static long elapsed_ns(struct timespec *start, struct timespec *end);
+static int compare_longs(const void *a, const void *b);
+
+
+/* Function: main
+ * --------------
+ * Loads the requested backends, runs every script against each, and prints
+ * one row per script. Returns the number of failed runs.
+ */
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"alloc", required_argument, NULL, 'a'},
+        {NULL, 0, NULL, 0}
+    };
+    char *alloc_list = NULL;
+    int c;
+    while ((c = getopt_long(argc, argv, "a:", long_options, NULL)) != EOF) {
+        if (c == 'a') {
+            alloc_list = optarg;
+        }
+    }
+    if (alloc_list == NULL || optind >= argc) {
+        error(1, 0, "Usage: %s --alloc=name[,name...] script...", argv[0]);
+    }
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    loaded_backend_t backends[MAX_BACKENDS];
+    int num_backends = load_backends(alloc_list, backends);
+    if (num_backends == 0) {
+        error(1, 0, "No allocator backend could be loaded.");
+    }
+
+    printf("%-24s", "script");
+    for (int b = 0; b < num_backends; b++) {
+        printf(" | %-26s", backends[b].name);
+    }
+    printf("\n%-24s", "");
+    for (int b = 0; b < num_backends; b++) {
+        printf(" | %5s %10s %9s", "util", "ops/sec", "p99 ns");
+    }
+    printf("\n");
+
+    int nfailures = 0;
+    for (int i = optind; i < argc; i++) {
+        script_t script = parse_script(argv[i]);
+        printf("%-24s", script.name);
+        for (int b = 0; b < num_backends; b++) {
+            memset(script.blocks, 0, script.num_ids * sizeof(block_t));
+            script.peak_size = 0;
+            run_result_t result = run_script(backends[b].backend, &script);
+            if (result.success) {
+                printf(" | %4d%% %10.0f %9ld", result.util, result.ops_per_sec, result.p99_ns);
+            } else {
+                printf(" | %26s", "FAILED");
+                nfailures++;
+            }
+        }
+        printf("\n");
+        free(script.ops);
+        free(script.blocks);
+    }
+
+    for (int b = 0; b < num_backends; b++) {
+        dlclose(backends[b].handle);
+    }
+    return nfailures;
+}
+
+/* Function: load_backends
+ * -----------------------
+ * Loads each backend named in the comma-separated list. Backends that
+ * cannot be loaded are reported and skipped. Returns the number loaded.
+ */
+static int load_backends(char *list, loaded_backend_t *backends) {
+    int num_backends = 0;
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (num_backends == MAX_BACKENDS) {
+            error(0, 0, "Too many backends, ignoring %s.", name);
+            continue;
+        }
+        char path[256];
+        if (strchr(name, '/') != NULL) {
+            snprintf(path, sizeof(path), "%s", name);
+        } else {
+            snprintf(path, sizeof(path), "./lib%s.so", name);
+        }
+
+        // RTLD_LOCAL keeps each backend's mymalloc out of the others' way
+        void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (handle == NULL) {
+            error(0, 0, "Could not load backend %s: %s", name, dlerror());
+            continue;
+        }
+        const allocator_backend *(*entry)(void) =
+            (const allocator_backend *(*)(void))dlsym(handle, ALLOCATOR_BACKEND_ENTRY);
+        if (entry == NULL) {
+            error(0, 0, "Backend %s has no %s entry point.", name, ALLOCATOR_BACKEND_ENTRY);
+            dlclose(handle);
+            continue;
+        }
+
+        loaded_backend_t *loaded = &backends[num_backends++];
+        snprintf(loaded->name, sizeof(loaded->name), "%s", name);
+        loaded->handle = handle;
+        loaded->backend = entry();
+    }
+    return num_backends;
+}
+
+/* Function: run_script
+ * --------------------
+ * Replays a script against one backend on a fresh heap segment, timing
+ * each allocator call. Payloads are filled with the low-order byte of the
+ * block id and checked before every realloc and free.
+ */
+static run_result_t run_script(const allocator_backend *backend, script_t *script) {
+    run_result_t result = {.success = false};
+
+    init_heap_segment(HEAP_SIZE);
+    if (!backend->init(heap_segment_start(), heap_segment_size())) {
+        return result;
+    }
+
+    long *latencies = malloc(script->num_ops * sizeof(long));
+    if (latencies == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    void *heap_end = heap_segment_start();
+    size_t cur_size = 0;
+    long total_ns = 0;
+    struct timespec start, end;
+
+    for (int req = 0; req < script->num_ops; req++) {
+        request_t *request = &script->ops[req];
+        block_t *block = &script->blocks[request->id];
+        void *p = NULL;
+
+        if (request->op == ALLOC) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            p = backend->malloc(request->size);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (p == NULL && request->size != 0) {
+                goto done;
+            }
+            cur_size += request->size;
+        } else if (request->op == REALLOC) {
+            if (!check_payload(block->ptr, block->size, request->id)) {
+                goto done;
+            }
+            size_t preserved = block->size < request->size ? block->size : request->size;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            p = backend->realloc(block->ptr, request->size);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if ((p == NULL && request->size != 0) || !check_payload(p, preserved, request->id)) {
+                goto done;
+            }
+            cur_size += request->size - block->size;
+        } else {
+            if (!check_payload(block->ptr, block->size, request->id)) {
+                goto done;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            backend->free(block->ptr);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            cur_size -= block->size;
+        }
+
+        latencies[req] = elapsed_ns(&start, &end);
+        total_ns += latencies[req];
+
+        if (request->op == FREE) {
+            *block = (block_t){.ptr = NULL, .size = 0};
+        } else {
+            if (((uintptr_t)p) % ALIGNMENT != 0) {
+                goto done;
+            }
+            memset(p, request->id & 0xFF, request->size);
+            *block = (block_t){.ptr = p, .size = request->size};
+            if ((char *)p + request->size > (char *)heap_end) {
+                heap_end = (char *)p + request->size;
+            }
+        }
+        if (cur_size > script->peak_size) {
+            script->peak_size = cur_size;
+        }
+    }
+
+    size_t used_segment = (char *)heap_end - (char *)heap_segment_start();
+    qsort(latencies, script->num_ops, sizeof(long), compare_longs);
+    result.success = true;
+    result.util = used_segment > 0 ? (100 * script->peak_size) / used_segment : 0;
+    result.ops_per_sec = total_ns > 0 ? script->num_ops * 1e9 / total_ns : 0;
+    result.p99_ns = script->num_ops > 0 ? latencies[(long)script->num_ops * 99 / 100] : 0;
+
+done:
+    free(latencies);
+    return result;
+}
+
+/* Function: check_payload
+ * -----------------------
+ * Verifies a block still holds the pattern written when it was allocated.
+ */
+static bool check_payload(void *ptr, size_t size, int id) {
+    for (size_t i = 0; i < size; i++) {
+        if (*((unsigned char *)ptr + i) != (id & 0xFF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function: elapsed_ns
+ * --------------------
+ * Returns the nanoseconds between two monotonic clock readings.
+ */
+static long elapsed_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
+}
+
+/* Function: compare_longs
+ * -----------------------
+ * qsort comparison for ascending longs.
+ */
+static int compare_longs(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
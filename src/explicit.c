@@ -1,20 +1,101 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "allocator.h"
 #include "debug_break.h"
+#include "free_bitmap.h"
+#include "handle.h"
+#include "heap_profile.h"
+#include "persist.h"
+#include "placement.h"
+#include "segment.h"
+#include "size_tuning.h"
+#include "trace_record.h"
 
 
 /**
  * Definitions
  */
 #define BLOCK_USED_MASK             0b001     
+#define BLOCK_SAMPLED_MASK          0b010     
+#define BLOCK_PREV_USED_MASK        0b100     
 #define BLOCK_SIZE_MASK             0b111     
-#define BLOCK_HEADER_BYTES          8
 #define MIN_PAYLOAD_BYTES           8
+
+/**
+ * Small helpers on the hot paths are internal to this file, and
+ * inlined whatever the optimization level
+ */
+#define INTERNAL_INLINE             static inline __attribute__ ((always_inline))
+
+/**
+ * Policies, chosen at compile time (see the variants in the Makefile):
+ * FIRST_FIT or NEXT_FIT take the first free block that fits, from the
+ * bottom of the heap or from where the last search ended, instead of
+ * the best fit. DEFERRED_COALESCING leaves freed blocks unmerged until
+ * an allocation would otherwise grow the heap
+ */
+#if defined (FIRST_FIT) && defined (NEXT_FIT)
+#error "FIRST_FIT and NEXT_FIT are exclusive"
+#endif
+
+/**
+ * Quick-lists: freed blocks up to QUICK_LIST_MAX_BLOCK bytes are kept,
+ * uncoalesced, on one LIFO list per exact block size, until an allocation
+ * would otherwise grow the heap or QUICK_LIST_MAX_BYTES are held
+ */
+#define QUICK_LIST_MAX_BLOCK      256
+#define QUICK_LIST_COUNT          (QUICK_LIST_MAX_BLOCK / ALIGNMENT + 1)
+#define QUICK_LIST_MAX_BYTES      (64 * 1024)
+
+/**
+ * CACHE_LINE_PLACEMENT moves a block whose payload of at most a 
+ * cache line would straddle two, to start on the next line, if that
+ * skips at most CACHE_LINE_MAX_SKIP bytes. They become a free block
+ */
+#define CACHE_LINE_MAX_SKIP        32
+
+/**
+ * Realloc growth history: recently grown blocks, by payload address,
+ * in a direct-mapped table. A block grown REALLOC_GROWTH_STREAK times
+ * in a row that has to move is given half again the requested size,
+ * so that its next growths fit in place
+ */
+#define REALLOC_HISTORY_SLOTS     256
+#define REALLOC_GROWTH_STREAK       2
+
+/**
+ * A realloc that moves a payload of at least REALLOC_REMAP_BYTES places
+ * the new payload at the same offset within a page as the old one, and
+ * remaps the whole pages between them rather than copying them
+ */
+#define REALLOC_REMAP_BYTES       (128 * 1024)
+
+/**
+ * Block format. COMPACT_HEADERS uses 4-byte headers and 32-bit
+ * offset links, for segments of at most 4 GiB. The heap then starts
+ * 4 bytes into the segment, so that payloads after the 12 bytes of
+ * overhead land on ALIGNMENT
+ */
+#define SUPERBLOCK_BYTES           48
+#ifdef COMPACT_HEADERS
+#define BLOCK_HEADER_BYTES          4
+#define BLOCK_LINK_BYTES            8
+#define HEAP_START_OFFSET           4
+#define MAX_SEGMENT_BYTES           (1UL << 32)
+#define SUPERBLOCK_MAGIC            0x6865617063743401UL
+#else
+#define BLOCK_HEADER_BYTES          8
 #define BLOCK_LINK_BYTES           16
+#define HEAP_START_OFFSET           0
+#define MAX_SEGMENT_BYTES           SIZE_MAX
+#define SUPERBLOCK_MAGIC            0x6865617063743402UL
+#endif
 
 
 /**
@@ -24,6 +105,61 @@ static void *segment_start;     // heap start
 static size_t segment_size;     // heap size
 
 static size_t bytes_used;       // heap bytes
+static bool top_prev_used;      // whether the last block is used, the prev-used
+                                //  bit of a block allocated at the heap top
+
+static heap_stats stats;        // allocation counters
+static size_t page_bytes;       // OS page size, for realloc remaps
+
+typedef struct {
+    void* payload_ptr;
+    size_t payload_bytes;       // after its last growth, to tell a reused address
+    unsigned long grow_count;
+} realloc_history_entry;
+
+static realloc_history_entry realloc_history[REALLOC_HISTORY_SLOTS];
+
+
+/**
+ * Superblock at the end of the segment, so that a heap in a file
+ * can be reattached by the next process. bytes_used is kept current;
+ * the rest is saved by heap_shutdown, which sets clean
+ */
+typedef struct {
+    uint64_t magic;             // SUPERBLOCK_MAGIC of the block format
+    uint64_t segment_size;
+    uint64_t bytes_used;
+    uint64_t free_head_offset;  // from segment_start, NO_BLOCK_OFFSET for none
+    uint64_t free_tail_offset;
+    uint32_t top_prev_used;
+    uint32_t clean;             // saved state is current
+} heap_superblock;
+
+_Static_assert (sizeof (heap_superblock) == SUPERBLOCK_BYTES, "superblock size");
+
+#define NO_BLOCK_OFFSET             UINT64_MAX
+
+static heap_superblock* superblock;     // at segment_start + segment_size
+static bool superblock_clean;           // superblock->clean, read without
+                                        //  touching the shared mapping
+static bool initialized;                // myinit was called by this process
+static bool reattached;                 // last myinit found an existing heap
+
+bool heap_reattach ();                  // see Persistence, below
+
+
+/**
+ * Marks the saved state in the superblock stale, once per session:
+ *  on the first change to the heap since it was attached or shut down
+ * 
+ * Returns: n/a
+ */
+INTERNAL_INLINE void mark_superblock_dirty () {
+    if (superblock_clean) {
+        superblock->clean = false;
+        superblock_clean = false;
+    }
+}
 
 
 /**
@@ -35,7 +171,7 @@ static size_t bytes_used;       // heap bytes
  * 
  * Return: if first pointer is within bound set by the second
  */
-bool within_bounds (void* ptr1, void* ptr2){
+INTERNAL_INLINE bool within_bounds (void* ptr1, void* ptr2){
     
     if (ptr1 == NULL  || ptr2 == NULL) {
         return false;
@@ -54,13 +190,24 @@ bool within_bounds (void* ptr1, void* ptr2){
  * Returns:
  *  pointer to the top of the header, shifted by the given offset
  */
-void* heap_top (size_t offset) {
+INTERNAL_INLINE void* heap_top (size_t offset) {
     void* top = (char*) segment_start + bytes_used + offset;
     assert (top != NULL);
     return top;
 } 
 
 
+/**
+ * Get address of the first block of the heap
+ * 
+ * Returns:
+ *  pointer to the header of the first block
+ */
+INTERNAL_INLINE void* heap_bottom () {
+    return (char*) segment_start + HEAP_START_OFFSET;
+}
+
+
 /**
  * Round a number to a the nearest multiple of another
  * This can be used to o keep alignment in memory allocation,
@@ -74,22 +221,51 @@ void* heap_top (size_t offset) {
  *  the nearest multiple
  * 
  */
-size_t roundup (size_t sz, size_t mult) {
+INTERNAL_INLINE size_t roundup (size_t sz, size_t mult) {
     return (sz + mult - 1) & ~(mult - 1);
 }
 
 
+/**
+ * Computes the statistics size class of a payload size,
+ *  which is the position of its highest set bit
+ * 
+ * Argument
+ *  - size: payload bytes
+ * 
+ * Returns: index into the heap_stats per-class counters
+ */
+size_t stats_size_class (size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    size_t size_class = 63 - __builtin_clzl (size);
+    if (size_class >= HEAP_STATS_SIZE_CLASSES) {
+        return HEAP_STATS_SIZE_CLASSES - 1;
+    }
+    return size_class;
+}
+
+
 /**
  * Heap allocation header 
  */
 typedef struct {
     /**
     * Header encoding:
-    * - higher 5 bytes represent the size of the block
-    * - lower 3 bytes are not used to represent size. 
+    * - higher bits represent the size of the block, header included,
+    *       a multiple of ALIGNMENT
+    * - lower 3 bits are not used to represent size. 
     *       Lowest bit used to represent free/used
+    *       Second bit marks used blocks tracked by the heap profiler
+    *       Third bit tells the previous block in the heap is used, 
+    *       otherwise it is free and ends with a footer copy of its header
     */
+#ifdef COMPACT_HEADERS
+    uint32_t encoding;
+#else
     unsigned long encoding;
+#endif
 
 } heap_header;
 
@@ -103,8 +279,9 @@ typedef struct {
  * 
  * Returns: size from the header's encoding
  */
-size_t header_payload_size (heap_header header) {
-    return (size_t) (header.encoding & ~BLOCK_SIZE_MASK);
+INTERNAL_INLINE size_t header_payload_size (heap_header header) {
+    return (size_t) (header.encoding & ~BLOCK_SIZE_MASK) - 
+        BLOCK_HEADER_BYTES - BLOCK_LINK_BYTES;
 }
 
 
@@ -116,23 +293,49 @@ size_t header_payload_size (heap_header header) {
  * 
  * Returns: wether the block is used or not
  */
-bool header_block_is_used (heap_header header) {
+INTERNAL_INLINE bool header_block_is_used (heap_header header) {
     return (bool) (header.encoding & BLOCK_USED_MASK);
 } 
 
 
+/**
+ * Get wether the block before the header's block is used
+ * 
+ * Argument
+ *  - header: the header to get the flag from
+ * 
+ * Returns: wether the previous block is used, so it has no footer
+ */
+INTERNAL_INLINE bool header_prev_block_is_used (heap_header header) {
+    return (bool) (header.encoding & BLOCK_PREV_USED_MASK);
+} 
+
+
+/**
+ * Get wether the header's block was sampled by the heap profiler
+ * 
+ * Argument
+ *  - header: the header to get the flag from
+ * 
+ * Returns: wether the block is tracked by the profiler
+ */
+INTERNAL_INLINE bool header_block_is_sampled (heap_header header) {
+    return (bool) (header.encoding & BLOCK_SAMPLED_MASK);
+} 
+
+
 /**
  * Factory of headers 
  * 
  * Argument
- *  - requested_size: block size, not counting the header
+ *  - requested_size: payload size, not counting the header and link
  *  - is_used: whether the block is being used
  * 
  * Returns: header with encoded size and usage
  */
-heap_header header_factory (size_t requested_size, bool is_used) {
+INTERNAL_INLINE heap_header header_factory (size_t requested_size, bool is_used) {
     heap_header header;
-    header.encoding = requested_size;
+    header.encoding = requested_size + BLOCK_HEADER_BYTES + BLOCK_LINK_BYTES;
     if (is_used) {
         header.encoding |= BLOCK_USED_MASK;
     } else {
@@ -142,12 +345,43 @@ heap_header header_factory (size_t requested_size, bool is_used) {
 }
 
 
+/**
+ * Sets the previous-block-used flag of a header
+ * 
+ * Argument
+ *  - header: the header to update
+ *  - prev_used: whether the block before it is used
+ * 
+ * Returns: header with the flag set accordingly
+ */
+INTERNAL_INLINE heap_header header_with_prev_used (heap_header header, bool prev_used) {
+    if (prev_used) {
+        header.encoding |= BLOCK_PREV_USED_MASK;
+    } else {
+        header.encoding &= ~BLOCK_PREV_USED_MASK;
+    }
+    return header;
+}
+
+
+/**
+ * Reference from one block to another in the free node link list:
+ *  a 32-bit offset from segment_start (0 for none) with compact headers,
+ *  otherwise a pointer
+ */
+#ifdef COMPACT_HEADERS
+typedef uint32_t link_ref;
+#else
+typedef heap_header* link_ref;
+#endif
+
+
 /**
  * Heap allocation node, to maintain a free node link list
  */ 
 typedef struct {
-    heap_header* prev_header;
-    heap_header* next_header;
+    link_ref prev_header;
+    link_ref next_header;
 } heap_link;
 
 
@@ -158,6 +392,75 @@ typedef struct {
 heap_header* free_blocks_head_ptr;
 heap_header* free_blocks_tail_ptr;
 
+#ifdef NEXT_FIT
+static heap_header* next_fit_cursor;    // where the last search ended, NULL for none
+#endif
+#ifdef DEFERRED_COALESCING
+static size_t deferred_frees;           // blocks freed since the last merge
+#endif
+
+
+/**
+ * Quick-list global variables
+ */
+static heap_header* quick_lists[QUICK_LIST_COUNT];  // top block per size
+static size_t quick_list_bytes;                     // block bytes held by quick-lists
+
+
+/**
+ * Handle table global variables
+ */
+typedef struct {
+    void* payload_ptr;          // current block payload, NULL if slot is free
+    unsigned int pins;          // hlock calls not yet matched by hunlock
+    unsigned int next_free;     // next free slot + 1, 0 for none
+} handle_entry;
+
+static handle_entry handles[HANDLE_TABLE_SIZE];
+static unsigned int handles_used;           // slots ever handed out
+static unsigned int handles_free_head;      // first free slot + 1, 0 for none
+static unsigned int compact_order[HANDLE_TABLE_SIZE];   // movable slots, by address
+
+/**
+ * Encodes a block pointer as a link reference
+ * 
+ * Argument
+ *  - header_ptr: pointer to a block, or NULL
+ * 
+ * Returns: reference to store in a link
+ */
+INTERNAL_INLINE link_ref link_ref_from_header (heap_header* header_ptr) {
+#ifdef COMPACT_HEADERS
+    if (header_ptr == NULL) {
+        return 0;
+    }
+    return (link_ref) ((char*) header_ptr - (char*) segment_start);
+#else
+    return header_ptr;
+#endif
+}
+
+
+/**
+ * Decodes a link reference into a block pointer
+ * 
+ * Argument
+ *  - ref: reference stored in a link
+ * 
+ * Returns: pointer to the block, or NULL
+ */
+INTERNAL_INLINE heap_header* header_from_link_ref (link_ref ref) {
+#ifdef COMPACT_HEADERS
+    if (ref == 0) {
+        return NULL;
+    }
+    return (heap_header*) ((char*) segment_start + ref);
+#else
+    return ref;
+#endif
+}
+
+
 /**
  * Factory of links 
  * 
@@ -169,8 +472,8 @@ heap_header* free_blocks_tail_ptr;
  */
 heap_link link_factory (heap_header* prev_header, heap_header* next_header) {
     heap_link link;
-    link.prev_header = prev_header;
-    link.next_header = next_header;
+    link.prev_header = link_ref_from_header (prev_header);
+    link.next_header = link_ref_from_header (next_header);
     return link;
 }
 
@@ -183,7 +486,7 @@ heap_link link_factory (heap_header* prev_header, heap_header* next_header) {
  * 
  * Returns: pointer to the link
  */
-heap_link* get_block_link_from_header (heap_header* header_ptr) {
+INTERNAL_INLINE heap_link* get_block_link_from_header (heap_header* header_ptr) {
     return (heap_link*) ((char*) header_ptr + BLOCK_HEADER_BYTES);
 }
 
@@ -191,7 +494,7 @@ heap_link* get_block_link_from_header (heap_header* header_ptr) {
 /**
  * Total bytest that are not payload in a heap block
  */
-size_t block_overhead_bytes () {
+INTERNAL_INLINE size_t block_overhead_bytes () {
     return BLOCK_HEADER_BYTES + BLOCK_LINK_BYTES;
 }
 
@@ -204,7 +507,7 @@ size_t block_overhead_bytes () {
  * 
  * Returns: pointer to the payload
  */
-void* get_block_payload_from_header (heap_header* header_ptr) {
+INTERNAL_INLINE void* get_block_payload_from_header (heap_header* header_ptr) {
     return (char*) header_ptr + block_overhead_bytes ();
 }
 
@@ -230,7 +533,7 @@ heap_header* get_block_pointer_from_link (heap_link* link_ptr) {
  * 
  * Returns: pointer to the header in the same heap block
  */
-heap_header* get_block_pointer_from_payload (void* payload_ptr) {
+INTERNAL_INLINE heap_header* get_block_pointer_from_payload (void* payload_ptr) {
     return (heap_header*) ((char*) payload_ptr - block_overhead_bytes ());
 }
 
@@ -244,7 +547,7 @@ heap_header* get_block_pointer_from_payload (void* payload_ptr) {
  * 
  * Returns: the location of the next header
  */
-heap_header* get_next_implicit_header (heap_header header_object, 
+INTERNAL_INLINE heap_header* get_next_implicit_header (heap_header header_object, 
                                        heap_header* header_ptr) {
     size_t size = header_payload_size (header_object);
     void* next_header = (char*) get_block_payload_from_header (header_ptr) + size;
@@ -262,7 +565,7 @@ heap_header* get_next_implicit_header (heap_header header_object,
  * Returns: poiiniter to the nextheader
  * 
  */
-heap_header* get_next_block_header (heap_header* header_ptr, size_t block_bytes) {
+INTERNAL_INLINE heap_header* get_next_block_header (heap_header* header_ptr, size_t block_bytes) {
     heap_header* next_ptr = (heap_header*) ((char*) header_ptr + block_bytes);
     return next_ptr;
 }
@@ -277,9 +580,9 @@ heap_header* get_next_block_header (heap_header* header_ptr, size_t block_bytes)
  *  
  * Returns: pointer to the next free block
  */
-heap_header* get_next_free_block_from_header (heap_header* header_ptr) {
+INTERNAL_INLINE heap_header* get_next_free_block_from_header (heap_header* header_ptr) {
     heap_link* link_ptr = get_block_link_from_header (header_ptr);
-    return link_ptr->next_header;        
+    return header_from_link_ref (link_ptr->next_header);        
 }
 
 
@@ -291,9 +594,9 @@ heap_header* get_next_free_block_from_header (heap_header* header_ptr) {
  *  
  * Returns: pointer to the previous free block
  */
-heap_header* get_prev_free_block_from_header (heap_header* header_ptr) {
+INTERNAL_INLINE heap_header* get_prev_free_block_from_header (heap_header* header_ptr) {
     heap_link* link_ptr = get_block_link_from_header (header_ptr);
-    return link_ptr->prev_header;        
+    return header_from_link_ref (link_ptr->prev_header);        
 }
 
 
@@ -306,7 +609,7 @@ heap_header* get_prev_free_block_from_header (heap_header* header_ptr) {
  */
 void set_next_free_node (heap_header* header_ptr, heap_header* next_header_ptr) {
     heap_link* link_ptr = get_block_link_from_header (header_ptr);   
-    link_ptr->next_header = next_header_ptr;
+    link_ptr->next_header = link_ref_from_header (next_header_ptr);
 }
 
 
@@ -319,7 +622,7 @@ void set_next_free_node (heap_header* header_ptr, heap_header* next_header_ptr)
  */
 void set_prev_free_node (heap_header* header_ptr, heap_header* prev_header_ptr) {
     heap_link* link_ptr = get_block_link_from_header (header_ptr);   
-    link_ptr->prev_header = prev_header_ptr;
+    link_ptr->prev_header = link_ref_from_header (prev_header_ptr);
 }
 
 
@@ -330,7 +633,7 @@ void set_prev_free_node (heap_header* header_ptr, heap_header* prev_header_ptr)
  *  - header_ptr: location
  *  - header: to write
  */
-void write_header (void* header_ptr, heap_header* header) {
+INTERNAL_INLINE void write_header (void* header_ptr, heap_header* header) {
     void* result = memcpy (header_ptr, header, BLOCK_HEADER_BYTES);
     assert (result != NULL); 
 }
@@ -344,7 +647,7 @@ void write_header (void* header_ptr, heap_header* header) {
  * 
  * Returns: header 
  */
-void read_header (heap_header* header_object, void *header_ptr) {
+INTERNAL_INLINE void read_header (heap_header* header_object, void *header_ptr) {
     void* result = memcpy (header_object, header_ptr, BLOCK_HEADER_BYTES); 
     assert (result != NULL);
 }
@@ -376,7 +679,7 @@ void write_link (heap_header* header_ptr, heap_link* link) {
  * 
  * Returns: size from the header's encoding
  */
-size_t block_payload_size (heap_header* header_ptr) {
+INTERNAL_INLINE size_t block_payload_size (heap_header* header_ptr) {
     heap_header header;
     read_header (&header, header_ptr);
     size_t size = header_payload_size (header);    
@@ -384,6 +687,58 @@ size_t block_payload_size (heap_header* header_ptr) {
 }
 
 
+/**
+ * Computes the pointer to the footer of a free block,
+ *  the last header-sized word of the block
+ * 
+ * Argument
+ *  - header_ptr: pointer to the header
+ *  - block_bytes: size of the whole block
+ * 
+ * Returns: pointer to the footer
+ */
+heap_header* get_block_footer (heap_header* header_ptr, size_t block_bytes) {
+    return (heap_header*) ((char*) header_ptr + block_bytes - BLOCK_HEADER_BYTES);
+}
+
+
+/**
+ * Get the previous block in the heap, which must be free,
+ *  from the footer that ends it
+ * 
+ * Argument
+ *  - header_ptr: pointer to the block after the free block
+ * 
+ * Returns: pointer to the header of the free block
+ */
+heap_header* get_prev_free_block_header (heap_header* header_ptr) {
+    heap_header footer;
+    read_header (&footer, (char*) header_ptr - BLOCK_HEADER_BYTES);
+    size_t block_bytes = block_overhead_bytes () + header_payload_size (footer);
+    return (heap_header*) ((char*) header_ptr - block_bytes);
+}
+
+
+/**
+ * Records whether the block before a location is used: in the 
+ *  header of the block there, or for the next block allocated
+ *  if the location is the heap top
+ * 
+ * Argument
+ *  - header_ptr: location of the block after the one that changed
+ *  - prev_used: whether the block before it is now used
+ * 
+ * Returns: n/a
+ */
+void set_prev_block_used (heap_header* header_ptr, bool prev_used) {
+    if (header_ptr == heap_top (0)) {
+        top_prev_used = prev_used;
+    } else if (within_bounds (header_ptr, heap_top (0))) {
+        *header_ptr = header_with_prev_used (*header_ptr, prev_used);
+    }
+}
+
+
 /**
  * Reset the heap allocator to an empty initial state
  * 
@@ -397,14 +752,15 @@ bool myinit (void *heap_start, size_t heap_size) {
 
     // stats
     bytes_used = 0;
+    memset (&stats, 0, sizeof (stats));
 
     // exception
-    if (heap_size == 0) {
+    if (heap_size <= SUPERBLOCK_BYTES || heap_size > MAX_SEGMENT_BYTES) {
         return false;
     }
 
-    // init 
-    segment_size = heap_size;
+    // init: the superblock takes the end of the segment
+    segment_size = (heap_size - SUPERBLOCK_BYTES) & ~(size_t) (ALIGNMENT - 1);
 
     // exception
     if (heap_start == NULL) {
@@ -413,8 +769,47 @@ bool myinit (void *heap_start, size_t heap_size) {
     
     // init
     segment_start = heap_start;
+    page_bytes = sysconf (_SC_PAGESIZE);
+    top_prev_used = true;
+    memset (quick_lists, 0, sizeof (quick_lists));
+    quick_list_bytes = 0;
+    memset (realloc_history, 0, sizeof (realloc_history));
+#ifndef TUNED_SPLIT_BYTES
+    size_tuning_reset (MIN_PAYLOAD_BYTES, QUICK_LIST_MAX_BLOCK - block_overhead_bytes ());
+#endif
+    handles_used = 0;
+    handles_free_head = 0;
     free_blocks_head_ptr = NULL;
     free_blocks_tail_ptr = NULL;
+#ifdef NEXT_FIT
+    next_fit_cursor = NULL;
+#endif
+#ifdef DEFERRED_COALESCING
+    deferred_frees = 0;
+#endif
+    heap_profile_reset ();
+    TRACE_INIT ();
+#ifdef FREE_BITMAP
+    if (!free_bitmap_init (heap_bottom (), segment_size - HEAP_START_OFFSET)) {
+        return false;
+    }
+#endif
+
+    // persistence: the first call of a process may find a heap to reattach
+    superblock = (heap_superblock*) ((char*) segment_start + segment_size);
+    reattached = !initialized && superblock->magic == SUPERBLOCK_MAGIC &&
+                 superblock->segment_size == heap_size;
+    initialized = true;
+    if (reattached) {
+        return heap_reattach ();
+    }
+
+    bytes_used = HEAP_START_OFFSET;
+    memset (superblock, 0, sizeof (heap_superblock));
+    superblock_clean = false;
+    superblock->magic = SUPERBLOCK_MAGIC;
+    superblock->segment_size = heap_size;
+    superblock->bytes_used = bytes_used;
     
     return true;
 }
@@ -423,12 +818,50 @@ bool myinit (void *heap_start, size_t heap_size) {
 /**
  * Returns the size of the smallest possible block
  */
-size_t min_block_size (){
+INTERNAL_INLINE size_t min_block_size (){
     // header plus link, plus minimal payload
     return block_overhead_bytes () + MIN_PAYLOAD_BYTES;
 }
 
 
+/**
+ * Returns the size of the smallest block worth splitting off a free 
+ *  block: one that fits a small request, as tuned to request sizes
+ *  unless compiled in
+ */
+size_t min_split_block_size () {
+#ifdef TUNED_SPLIT_BYTES
+    size_t split_bytes = TUNED_SPLIT_BYTES;
+#else
+    size_t split_bytes = size_tuning_split_bytes ();
+#endif
+    return block_overhead_bytes () + 
+           (split_bytes > MIN_PAYLOAD_BYTES ? split_bytes : MIN_PAYLOAD_BYTES);
+}
+
+
+/**
+ * Returns the size of the largest block kept on a quick-list, as
+ *  tuned to request sizes unless compiled in
+ */
+size_t quick_list_max_block () {
+#ifdef TUNED_QUICK_LIST_BYTES
+    size_t max_block = block_overhead_bytes () + TUNED_QUICK_LIST_BYTES;
+#else
+    size_t max_block = block_overhead_bytes () + size_tuning_quick_list_bytes ();
+#endif
+    return max_block < QUICK_LIST_MAX_BLOCK ? max_block : QUICK_LIST_MAX_BLOCK;
+}
+
+
+/**
+ * Size of the smallest free block: header, link and footer
+ */
+INTERNAL_INLINE size_t min_free_block_size () {
+    return roundup (2 * BLOCK_HEADER_BYTES + BLOCK_LINK_BYTES, ALIGNMENT);
+}
+
+
 /**
  * Returns the size of the smallest block to fit a request
  */ 
@@ -438,26 +871,36 @@ size_t min_requested_size (size_t bytes_requested) {
 
 
 /**
- * Validates that the requested size for a new allocation 
- *  is within granted heap bounds/rules
+ * Returns the size of the padded block for a request, wherever 
+ *  in the heap it goes
  * 
  * Arguments:
  *  - bytes_requested: size the caller wants to store
  * 
- * Returns: true/false if the bytes requested can be granted
+ * Returns: the block size, or 0 for an empty or oversized request
  */ 
-size_t valid_alloc (size_t bytes_requested) {
+size_t request_block_bytes (size_t bytes_requested) {
     
-    if (bytes_requested == 0) {
+    if (bytes_requested == 0 || bytes_requested > MAX_REQUEST_SIZE) {
         return 0;
     }
     
-    size_t padded_block_bytes = 
-        roundup (min_requested_size (bytes_requested), ALIGNMENT);
+    return roundup (min_requested_size (bytes_requested), ALIGNMENT);
+}
 
-    if (bytes_requested > MAX_REQUEST_SIZE) {
-        return 0;
-    }
+
+/**
+ * Validates that the requested size for a new allocation 
+ *  is within granted heap bounds/rules
+ * 
+ * Arguments:
+ *  - bytes_requested: size the caller wants to store
+ * 
+ * Returns: true/false if the bytes requested can be granted
+ */ 
+size_t valid_alloc (size_t bytes_requested) {
+    
+    size_t padded_block_bytes = request_block_bytes (bytes_requested);
     
     if (padded_block_bytes + bytes_used > segment_size) {
         return 0;
@@ -479,7 +922,43 @@ size_t request_payload (size_t padded_block_bytes) {
 
 
 /**
- * Finds the location of an unused block meeting size criterion
+ * Finds the first block of the free list, or the free-block bitmap, 
+ *  at or after an address. Both are in address order; the list also 
+ *  keeps used blocks
+ * 
+ * Argument
+ *  - from_ptr: where to start
+ * 
+ * Returns: the block, or NULL if there is none
+ */
+heap_header* first_listed_block_from (heap_header* from_ptr) {
+#ifdef FREE_BITMAP
+    return free_bitmap_next (from_ptr, heap_top (0));
+#else
+    heap_header* curr_header_ptr = free_blocks_head_ptr;
+    while (curr_header_ptr != NULL && within_bounds (curr_header_ptr, from_ptr)) {
+        curr_header_ptr = get_next_free_block_from_header (curr_header_ptr);
+    }
+    return curr_header_ptr;
+#endif
+}
+
+
+/**
+ * Returns the block after another, in the free list or free-block bitmap
+ */
+heap_header* next_listed_block (heap_header* header_ptr) {
+#ifdef FREE_BITMAP
+    return free_bitmap_next ((char*) header_ptr + 1, heap_top (0));
+#else
+    return get_next_free_block_from_header (header_ptr);
+#endif
+}
+
+
+/**
+ * Finds the location of an unused block meeting size criterion:
+ *  the best fit, or the first one per FIRST_FIT or NEXT_FIT
  * 
  * Argument
  *  - requested_size: the amount of memory requested
@@ -489,20 +968,38 @@ size_t request_payload (size_t padded_block_bytes) {
 heap_header* find_free_block (size_t requested_size) {
     
     // heap
-    size_t padded_block_bytes = valid_alloc (requested_size);
+    size_t padded_block_bytes = request_block_bytes (requested_size);
     size_t padded_payload_bytes = request_payload (padded_block_bytes);
 
-    heap_header* curr_header_ptr = free_blocks_head_ptr; 
-    if (curr_header_ptr == NULL) {
-        return NULL;
+    // next fit starts where the last search ended, then wraps around
+    heap_header* start_ptr = heap_bottom ();
+#ifdef NEXT_FIT
+    if (next_fit_cursor != NULL) {
+        start_ptr = next_fit_cursor;
     }
+#endif
+    heap_header* curr_header_ptr = first_listed_block_from (start_ptr);
+    bool wrapped = start_ptr == heap_bottom ();
 
     // header
     heap_header header;
     heap_header* found_fit = NULL;
+#if !defined (FIRST_FIT) && !defined (NEXT_FIT)
     size_t best_size = 0;
-
-    while (curr_header_ptr != NULL) {
+#endif
+
+    while (true) {
+
+        // end, or back where a wrapped search started
+        if (curr_header_ptr == NULL || 
+            (start_ptr != heap_bottom () && wrapped && !within_bounds (curr_header_ptr, start_ptr))) {
+            if (wrapped) {
+                break;
+            }
+            wrapped = true;
+            curr_header_ptr = first_listed_block_from (heap_bottom ());
+            continue;
+        }
 
         // current
         read_header (&header, curr_header_ptr);
@@ -510,18 +1007,28 @@ heap_header* find_free_block (size_t requested_size) {
         bool is_used = header_block_is_used (header);
         
         if (!is_used && size >= padded_payload_bytes) {
+#if defined (FIRST_FIT) || defined (NEXT_FIT)
+            found_fit = curr_header_ptr;
+            break;
+#else
             // no fit found yet, or candidate fit found
             if (best_size == 0 || size < best_size) { 
                 // no fit found yet
                 found_fit = curr_header_ptr; 
                 best_size = size; 
             } 
+#endif
         } 
         
         // next
-        curr_header_ptr = get_next_free_block_from_header (curr_header_ptr); 
+        curr_header_ptr = next_listed_block (curr_header_ptr);
     }
 
+#ifdef NEXT_FIT
+    if (found_fit != NULL) {
+        next_fit_cursor = found_fit;
+    }
+#endif
     return found_fit;
 }
 
@@ -676,7 +1183,12 @@ void delete_free_block_in_linked_list (heap_header* delete_ptr) {
 void write_free_block_header (heap_header* header_ptr, size_t block_bytes) {
     size_t padded_payload_bytes = block_bytes - block_overhead_bytes();
     heap_header header = header_factory (padded_payload_bytes, false);
+    header = header_with_prev_used (header, header_prev_block_is_used (*header_ptr));
     write_header (header_ptr, &header);
+    write_header (get_block_footer (header_ptr, block_bytes), &header);
+#ifdef FREE_BITMAP
+    free_bitmap_mark (header_ptr);
+#endif
 }
 
 
@@ -692,7 +1204,12 @@ void write_free_block_header (heap_header* header_ptr, size_t block_bytes) {
 void write_used_block_header (heap_header* header_ptr, size_t block_bytes) {
     size_t padded_payload_bytes = block_bytes - block_overhead_bytes();
     heap_header header = header_factory (padded_payload_bytes, true);
+    header = header_with_prev_used (header, header_prev_block_is_used (*header_ptr));
     write_header (header_ptr, &header);
+    set_prev_block_used (get_next_block_header (header_ptr, block_bytes), true);
+#ifdef FREE_BITMAP
+    free_bitmap_unmark (header_ptr);
+#endif
 }
 
 
@@ -740,6 +1257,29 @@ void write_coalesced_free_super_block_link (heap_header* curr_header_ptr,
 }
 
 
+/**
+ * Merges a free block into the free block before it in the heap
+ * 
+ * Argument
+ *  - curr_header_ptr: pointer to the free block, already in the list
+ *  - curr_block_bytes: size of the free block
+ * 
+ * Returns: n/a
+ */
+void coalescing_left (heap_header* curr_header_ptr, size_t curr_block_bytes) {
+
+    heap_header* prev_header_ptr = get_prev_free_block_header (curr_header_ptr);
+    size_t prev_block_bytes = block_overhead_bytes () + block_payload_size (prev_header_ptr);
+
+    delete_free_block_in_linked_list (curr_header_ptr);
+    write_free_block_header (prev_header_ptr, prev_block_bytes + curr_block_bytes);
+#ifdef FREE_BITMAP
+    free_bitmap_unmark (curr_header_ptr);
+#endif
+    stats.coalesce_count++;
+}
+
+
 /**
  * Free a block at a header, with a certain size
  * 
@@ -754,6 +1294,15 @@ void free_heap_block (heap_header* curr_header_ptr, size_t curr_paylod_bytes) {
     size_t eatable_block_bytes = 0;
     
     size_t curr_block_bytes = block_overhead_bytes() + curr_paylod_bytes;
+
+#ifdef DEFERRED_COALESCING
+    // left for coalesce_free_blocks
+    write_free_block_header (curr_header_ptr, curr_block_bytes);
+    insert_free_block_in_linked_list (curr_header_ptr);
+    set_prev_block_used (get_next_block_header (curr_header_ptr, curr_block_bytes), false);
+    deferred_frees++;
+    return;
+#endif
     
     heap_header* next_block_ptr = get_next_block_header (curr_header_ptr, curr_block_bytes);
 
@@ -770,62 +1319,236 @@ void free_heap_block (heap_header* curr_header_ptr, size_t curr_paylod_bytes) {
         // free block to the right
         write_free_block_header (curr_header_ptr, super_block_bytes);
         write_coalesced_free_super_block_link (curr_header_ptr, next_block_ptr);
+#ifdef FREE_BITMAP
+        free_bitmap_unmark (next_block_ptr);
+#endif
+        stats.coalesce_count++;
+    }
+
+    // the following block now comes after a free block
+    set_prev_block_used (get_next_block_header (curr_header_ptr, super_block_bytes), false);
+
+    // free block to the left
+    if (!header_prev_block_is_used (*curr_header_ptr)) {
+        coalescing_left (curr_header_ptr, super_block_bytes);
     }
 }
 
 
+#ifdef DEFERRED_COALESCING
+void rebuild_free_blocks ();            // with heap_compact, below
+
+
 /**
- * Free memory previously allocated
+ * Merges every run of adjacent free blocks left by deferred 
+ *  coalescing, then rebuilds the free list from the heap
  * 
- * Argument
- *  - ptr: pointer for the memory location
+ * Returns: true/false on whether any blocks were merged
  */
-void myfree (void *payload_ptr) {
+bool coalesce_free_blocks () {
 
-    if (payload_ptr == NULL) {
-        return;
+    if (deferred_frees == 0) {
+        return false;
     }
-    
-    heap_header* header_ptr = get_block_pointer_from_payload (payload_ptr);
-    size_t payload_bytes = block_payload_size (header_ptr);
-    free_heap_block (header_ptr, payload_bytes);
+    deferred_frees = 0;
+
+    // heap
+    heap_header* ptr = heap_bottom (); 
+    void* heap_end = heap_top (0);
+    size_t merged_count = 0;
+
+    while (within_bounds (ptr, heap_end)) {
+        // current, with the free blocks right after it
+        size_t block_bytes = block_overhead_bytes () + block_payload_size (ptr);
+        if (!header_block_is_used (*ptr)) {
+            heap_header* next_ptr = get_next_block_header (ptr, block_bytes);
+            while (within_bounds (next_ptr, heap_end) && !header_block_is_used (*next_ptr)) {
+                block_bytes += block_overhead_bytes () + block_payload_size (next_ptr);
+                merged_count++;
+                next_ptr = get_next_block_header (ptr, block_bytes);
+            }
+            heap_header header = header_factory (block_bytes - block_overhead_bytes (), false);
+            header = header_with_prev_used (header, header_prev_block_is_used (*ptr));
+            write_header (ptr, &header);
+        }
+        // next
+        ptr = get_next_block_header (ptr, block_bytes);
+    }
+
+    if (merged_count == 0) {
+        return false;
+    }
+    stats.coalesce_count += merged_count;
+    rebuild_free_blocks ();
+    return true;
 }
+#endif
 
 
 /**
- * Reuse a previously-freed block.  If there is enough space fragmented, 
- *  create a new split block, in additionn to the block to insert
+ * Location of a quick-listed block's next reference: the start of
+ *  the payload, as the block keeps its free node link. A link_ref
+ *  fits in the smallest payload
  * 
  * Argument
- *  - insert_ptr: the location to place a block that was freed
- *  - padded_block_bytes: the amount of free memory available
- *  - padded_payload_bytes: the payload we want to store
- * 
- * Returns:
- *  - 0 if a single block will be inserted
- *  - >0 bytes allocted to the fragmented block
+ *  - header_ptr: pointer to the block
+ * 
+ * Returns: pointer to the next reference
+ */
+link_ref* quick_list_next (heap_header* header_ptr) {
+    return (link_ref*) get_block_payload_from_header (header_ptr);
+}
+
+
+/**
+ * Frees every quick-listed block, coalescing each with its neighbors
+ * 
+ * Returns: whether any block was freed
+ */
+bool quick_list_flush () {
+
+    if (quick_list_bytes == 0) {
+        return false;
+    }
+
+    for (size_t index = 0; index < QUICK_LIST_COUNT; index++) {
+        heap_header* header_ptr = quick_lists[index];
+        while (header_ptr != NULL) {
+            heap_header* next_ptr = header_from_link_ref (*quick_list_next (header_ptr));
+            free_heap_block (header_ptr, block_payload_size (header_ptr));
+            header_ptr = next_ptr;
+        }
+        quick_lists[index] = NULL;
+    }
+    quick_list_bytes = 0;
+    return true;
+}
+
+
+/**
+ * Holds a freed block on the quick-list of its size.
+ *  The block stays marked used, so nothing coalesces with it
+ * 
+ * Argument
+ *  - header_ptr: pointer to the block
+ *  - payload_bytes: payload size of the block
+ * 
+ * Returns: false if the block is too big for a quick-list
+ */
+bool quick_list_push (heap_header* header_ptr, size_t payload_bytes) {
+
+    size_t block_bytes = block_overhead_bytes () + payload_bytes;
+    if (block_bytes > quick_list_max_block ()) {
+        return false;
+    }
+    if (quick_list_bytes + block_bytes > QUICK_LIST_MAX_BYTES) {
+        quick_list_flush ();
+    }
+
+    size_t index = block_bytes / ALIGNMENT;
+    header_ptr->encoding &= ~BLOCK_SAMPLED_MASK;
+    *quick_list_next (header_ptr) = link_ref_from_header (quick_lists[index]);
+    quick_lists[index] = header_ptr;
+    quick_list_bytes += block_bytes;
+    return true;
+}
+
+
+/**
+ * Takes the most recently freed block of a size off its quick-list
+ * 
+ * Argument
+ *  - block_bytes: size of the whole block
+ * 
+ * Returns: pointer to the block, or NULL if there is none
+ */
+heap_header* quick_list_pop (size_t block_bytes) {
+
+    if (block_bytes == 0 || block_bytes > QUICK_LIST_MAX_BLOCK) {
+        return NULL;
+    }
+
+    size_t index = block_bytes / ALIGNMENT;
+    heap_header* header_ptr = quick_lists[index];
+    if (header_ptr != NULL) {
+        quick_lists[index] = header_from_link_ref (*quick_list_next (header_ptr));
+        quick_list_bytes -= block_bytes;
+    }
+    return header_ptr;
+}
+
+
+/**
+ * Free memory previously allocated
+ * 
+ * Argument
+ *  - ptr: pointer for the memory location
+ */
+void myfree (void *payload_ptr) {
+
+    if (payload_ptr == NULL) {
+        return;
+    }
+    mark_superblock_dirty ();
+    
+    heap_header* header_ptr = get_block_pointer_from_payload (payload_ptr);
+    size_t payload_bytes = block_payload_size (header_ptr);
+    stats.free_count[stats_size_class (payload_bytes)]++;
+    if (header_block_is_sampled (*header_ptr)) {
+        heap_profile_record_free (payload_ptr);
+    }
+    TRACE_FREE (payload_ptr);
+    if (!quick_list_push (header_ptr, payload_bytes)) {
+        free_heap_block (header_ptr, payload_bytes);
+    }
+}
+
+
+/**
+ * Reuse a previously-freed block.  If there is enough space fragmented, 
+ *  create a new split block, in additionn to the block to insert
+ * 
+ * Argument
+ *  - insert_ptr: the location to place a block that was freed
+ *  - padded_block_bytes: the amount of free memory available
+ *  - padded_payload_bytes: the payload we want to store
+ * 
+ * Returns:
+ *  - 0 if a single block will be inserted
+ *  - >0 bytes allocted to the fragmented block
  * 
  */
 void alloc_free_block (heap_header* insert_ptr, 
                        size_t padded_block_bytes, size_t padded_payload_bytes) {
 
     size_t free_size = block_payload_size (insert_ptr);
+    bool prev_used = header_prev_block_is_used (*insert_ptr);
+#ifdef FREE_BITMAP
+    free_bitmap_unmark (insert_ptr);
+#endif
     
     // is there enough space to justify a split?
-    if (free_size >= padded_block_bytes + min_block_size ()) {
+    if (free_size >= padded_block_bytes + min_split_block_size ()) {
         // partition: used 
         heap_header header_insert = header_factory (padded_payload_bytes, true);
+        header_insert = header_with_prev_used (header_insert, prev_used);
         write_header (insert_ptr, &header_insert);
-        // partition: free
+        // partition: free, after the used partition
         heap_header* split_ptr = get_next_block_header (insert_ptr, 
                                                         padded_block_bytes);
         size_t split_size = free_size - padded_block_bytes;
+        heap_header header_split = header_factory (split_size, false);
+        header_split = header_with_prev_used (header_split, true);
+        write_header (split_ptr, &header_split);
         free_heap_block (split_ptr, split_size);
+        stats.split_count++;
         
     } else {
         // main
         heap_header header_insert = header_factory (free_size, true);
+        header_insert = header_with_prev_used (header_insert, prev_used);
         write_header (insert_ptr, &header_insert);
+        set_prev_block_used (get_next_implicit_header (header_insert, insert_ptr), true);
     }
 }
 
@@ -841,41 +1564,174 @@ void alloc_free_block (heap_header* insert_ptr,
 void alloc_new_block (heap_header* insert_ptr, size_t padded_block_bytes, 
                      size_t padded_payload_bytes) {
     heap_header header_insert = header_factory (padded_payload_bytes, true);    
+    header_insert = header_with_prev_used (header_insert, top_prev_used);
     write_header (insert_ptr, &header_insert);
     heap_link link_insert = link_factory (NULL, NULL);
     write_link (insert_ptr, &link_insert);
+    top_prev_used = true;
 }
 
 
 /**
- * Allocate memory in the heap
+ * Splits a free block in two free blocks, the first of lead_bytes,
+ *  without coalescing them again
+ * 
+ * Argument
+ *  - header_ptr: free block, in the free list
+ *  - block_bytes: its size
+ *  - lead_bytes: size of the first part, at least a free block
+ * 
+ * Returns: the second part
+ */
+heap_header* split_leading_free_block (heap_header* header_ptr, size_t block_bytes,
+                                       size_t lead_bytes) {
+
+    write_free_block_header (header_ptr, lead_bytes);
+
+    heap_header* rest_ptr = get_next_block_header (header_ptr, lead_bytes);
+    heap_header rest = header_factory (block_bytes - lead_bytes - block_overhead_bytes (), false);
+    rest = header_with_prev_used (rest, false);
+    write_header (rest_ptr, &rest);
+    write_free_block_header (rest_ptr, block_bytes - lead_bytes);
+    insert_free_block_in_linked_list (rest_ptr);
+    stats.split_count++;
+    return rest_ptr;
+}
+
+
+/**
+ * Moves a block's placement so that its payload starts align_offset
+ *  bytes past a multiple of align_bytes, when the bytes skipped are at
+ *  most max_skip. They become a free block: the front of the free 
+ *  block the block was to reuse, or a new one at the top of the heap
+ * 
+ * Argument
+ *  - insert_ptr: where the block would go
+ *  - is_reuse: whether that is a free block, else the heap top
+ *  - padded_block_bytes: size of the block
+ *  - align_bytes: the boundary, a power of two, such as a cache line
+ *  - align_offset: where the payload goes past the boundary
+ *  - max_skip: most bytes to skip
+ * 
+ * Returns: where the block goes
+ */
+heap_header* place_on_boundary (heap_header* insert_ptr, bool is_reuse,
+                                size_t padded_block_bytes, size_t align_bytes,
+                                size_t align_offset, size_t max_skip) {
+
+    uintptr_t payload = (uintptr_t) get_block_payload_from_header (insert_ptr);
+    size_t skip_bytes = (align_offset - payload) & (align_bytes - 1);
+    if (skip_bytes == 0) {
+        return insert_ptr;
+    }
+    if (skip_bytes < min_free_block_size ()) {
+        skip_bytes += align_bytes;
+    }
+    if (skip_bytes > max_skip) {
+        return insert_ptr;
+    }
+
+    if (is_reuse) {
+        size_t free_bytes = block_overhead_bytes () + block_payload_size (insert_ptr);
+        if (free_bytes < skip_bytes + padded_block_bytes) {
+            return insert_ptr;
+        }
+        return split_leading_free_block (insert_ptr, free_bytes, skip_bytes);
+    }
+
+    if (bytes_used + skip_bytes + padded_block_bytes > segment_size) {
+        return insert_ptr;
+    }
+    size_t skip_payload_bytes = skip_bytes - block_overhead_bytes ();
+    alloc_new_block (insert_ptr, skip_bytes, skip_payload_bytes);
+    bytes_used += skip_bytes;
+    superblock->bytes_used = bytes_used;
+    free_heap_block (insert_ptr, skip_payload_bytes);
+    return heap_top (0);
+}
+
+
+/**
+ * Allocate memory in the heap, for mymalloc, mymalloc_isolated and
+ *  realloc moves that remap pages. The placement is best effort: 
+ *  there may not be room to skip to the boundary
  * 
  * Arguments:
  *  requested_size: number of bytes requested
+ *  align_bytes: boundary the payload is placed against, or 0 for none
+ *  align_offset: where the payload goes past the boundary
+ * 
+ * Returns: the payload, or NULL if no free block fits and the heap 
+ *  cannot grow to fit it
  */
-void* mymalloc (size_t requested_size) {
+void* heap_alloc (size_t requested_size, size_t align_bytes, size_t align_offset) {
     
     // exception
     if (!requested_size) {
         return NULL;
     }
+    mark_superblock_dirty ();
+#ifndef TUNED_SPLIT_BYTES
+    size_tuning_record (requested_size);
+#endif
     
-    // scope
-    size_t padded_block_bytes = valid_alloc (requested_size);
+    // scope: free blocks may serve a request that no longer fits at the top
+    size_t padded_block_bytes = request_block_bytes (requested_size);
+    if (!padded_block_bytes) {
+        return NULL;
+    }
     size_t padded_payload_bytes = request_payload (padded_block_bytes);
+
+    // an aligned block needs room to skip up to its boundary in a free block
+    bool is_aligned = align_bytes > 0;
+    size_t max_skip = is_aligned ? align_bytes + min_free_block_size () : 0;
+#ifdef CACHE_LINE_PLACEMENT
+    if (!is_aligned && padded_payload_bytes <= CACHE_LINE_BYTES) {
+        max_skip = CACHE_LINE_MAX_SKIP;
+    }
+#endif
     
-    // identify location
-    heap_header* insert_ptr = find_free_block (requested_size);
+    // identify location: a quick-listed block of this exact size,
+    //  else a free block, coalescing quick-lists before growing the heap
+    heap_header* insert_ptr = is_aligned ? NULL : quick_list_pop (padded_block_bytes);
+    bool is_quick = insert_ptr != NULL;
+    if (!is_quick) {
+        insert_ptr = find_free_block (requested_size + (is_aligned ? max_skip : 0));
+    }
+    if (insert_ptr == NULL && quick_list_flush ()) {
+        insert_ptr = find_free_block (requested_size + (is_aligned ? max_skip : 0));
+    }
+#ifdef DEFERRED_COALESCING
+    if (insert_ptr == NULL && coalesce_free_blocks ()) {
+        insert_ptr = find_free_block (requested_size + (is_aligned ? max_skip : 0));
+    }
+#endif
     bool is_reuse = true;
     if (insert_ptr == NULL) {
+        if (!valid_alloc (requested_size)) {
+            return NULL;
+        }
         insert_ptr = heap_top (0);
         is_reuse = false;
     }
 
-    if (is_reuse) {
-        alloc_free_block (insert_ptr, padded_block_bytes, padded_payload_bytes);
-    } else {
+    // placement: aligned as asked, else small payloads off line boundaries
+    if (is_aligned) {
+        insert_ptr = place_on_boundary (insert_ptr, is_reuse, padded_block_bytes, 
+                                        align_bytes, align_offset, max_skip);
+    } else if (!is_quick && max_skip > 0) {
+        uintptr_t payload = (uintptr_t) get_block_payload_from_header (insert_ptr);
+        size_t line_offset = payload % CACHE_LINE_BYTES;
+        if (line_offset + padded_payload_bytes > CACHE_LINE_BYTES) {
+            insert_ptr = place_on_boundary (insert_ptr, is_reuse, padded_block_bytes, 
+                                            CACHE_LINE_BYTES, 0, max_skip);
+        }
+    }
+
+    if (!is_reuse) {
         alloc_new_block (insert_ptr, padded_block_bytes, padded_payload_bytes);
+    } else if (!is_quick) {
+        alloc_free_block (insert_ptr, padded_block_bytes, padded_payload_bytes);
     }
     
     // payload
@@ -885,12 +1741,43 @@ void* mymalloc (size_t requested_size) {
     // update
     if (!is_reuse) {
         bytes_used += padded_block_bytes;
+        superblock->bytes_used = bytes_used;
+    }
+    stats.alloc_count[stats_size_class (padded_payload_bytes)]++;
+
+    // profile: a single countdown unless this allocation is sampled
+    if (heap_profile_should_sample (padded_payload_bytes) &&
+        heap_profile_record_alloc (payload_ptr, padded_payload_bytes)) {
+        insert_ptr->encoding |= BLOCK_SAMPLED_MASK;
     }
+    TRACE_MALLOC (payload_ptr, requested_size);
 
     return payload_ptr;
 }
 
 
+/**
+ * Allocate memory in the heap
+ * 
+ * Arguments:
+ *  requested_size: number of bytes requested
+ */
+void* mymalloc (size_t requested_size) {
+    return heap_alloc (requested_size, 0, 0);
+}
+
+
+/**
+ * Allocate memory in the heap on whole cache lines
+ * 
+ * Arguments:
+ *  requested_size: number of bytes requested
+ */
+void* mymalloc_isolated (size_t requested_size) {
+    return heap_alloc (roundup (requested_size, CACHE_LINE_BYTES), CACHE_LINE_BYTES, 0);
+}
+
+
 /**
  * Attempt coalescing blocks to the right, to combine a certain size.
  *  Free contiguous-right blocks are coalesced, even if realloc in place ends 
@@ -961,8 +1848,13 @@ void realloc_inplace (heap_header* home_ptr, heap_header* last_free_coalesced,
     while (curr_ptr <= last_free_coalesced &&
            curr_ptr != NULL) {
         delete_free_block_in_linked_list (curr_ptr);
+        stats.coalesce_count++;
         curr_ptr = get_next_free_block_from_header (curr_ptr);
     }
+#ifdef FREE_BITMAP
+    free_bitmap_unmark_range (first_free_coalesced, 
+                              get_next_block_header (home_ptr, super_block_bytes));
+#endif
     
     // apply splitting policy
     size_t padded_payload_bytes = request_payload (padded_block_bytes);
@@ -973,6 +1865,72 @@ void realloc_inplace (heap_header* home_ptr, heap_header* last_free_coalesced,
 }
 
 
+/**
+ * Entry of a block in the realloc growth history
+ * 
+ * Argument
+ *  - payload_ptr: the block's payload
+ * 
+ * Returns: its slot, which may hold another block
+ */
+realloc_history_entry* realloc_history_slot (void* payload_ptr) {
+    uintptr_t key = (uintptr_t) payload_ptr / ALIGNMENT;
+    return &realloc_history[((key * 0x9e3779b97f4a7c15UL) >> 32) % REALLOC_HISTORY_SLOTS];
+}
+
+
+/**
+ * Records a growth of a block in the realloc history
+ * 
+ * Argument
+ *  - payload_ptr: the block's payload, after growing
+ *  - grow_count: times in a row it has grown
+ * 
+ * Returns: n/a
+ */
+void realloc_history_record (void* payload_ptr, unsigned long grow_count) {
+    realloc_history_entry* entry = realloc_history_slot (payload_ptr);
+    entry->payload_ptr = payload_ptr;
+    entry->payload_bytes = block_payload_size (get_block_pointer_from_payload (payload_ptr));
+    entry->grow_count = grow_count;
+}
+
+
+/**
+ * Moves a payload to a new block by remapping its whole pages, and
+ *  copying the partial pages at either end. The payloads must have the
+ *  same offset within a page
+ * 
+ * Argument
+ *  - new_payload_ptr: the new block's payload
+ *  - old_payload_ptr: the block's payload, freed afterwards
+ *  - size: bytes to move
+ * 
+ * Returns: true/false on whether the pages could be remapped, else
+ *  nothing was moved
+ */
+bool realloc_remap (void* new_payload_ptr, void* old_payload_ptr, size_t size) {
+
+    uintptr_t old_start = (uintptr_t) old_payload_ptr;
+    uintptr_t old_end = old_start + size;
+    uintptr_t pages_start = roundup (old_start, page_bytes);
+    uintptr_t pages_end = old_end & ~(page_bytes - 1);
+    if (((uintptr_t) new_payload_ptr - old_start) % page_bytes != 0 || pages_end <= pages_start) {
+        return false;
+    }
+
+    char* new_ptr = new_payload_ptr;
+    if (!move_heap_pages (new_ptr + (pages_start - old_start), (void*) pages_start, 
+                          pages_end - pages_start)) {
+        return false;
+    }
+    memcpy (new_ptr, old_payload_ptr, pages_start - old_start);
+    memcpy (new_ptr + (pages_end - old_start), (void*) pages_end, old_end - pages_end);
+    stats.realloc_copy_bytes += size - (pages_end - pages_start);
+    return true;
+}
+
+
 /**
  * Re-size previously-allocated memory block.
  * It allocates a new block, and moves existent content
@@ -983,19 +1941,42 @@ void realloc_inplace (heap_header* home_ptr, heap_header* last_free_coalesced,
  */
 void* myrealloc (void *old_payload_ptr, size_t requested_size) {
 
+    // record as one realloc, not the malloc/free it may fall back to
+    TRACE_REALLOC_BEGIN ();
+    mark_superblock_dirty ();
+
     // header
     heap_header* home_ptr = get_block_pointer_from_payload (old_payload_ptr);
     size_t old_payload_size = block_payload_size (home_ptr);
 
+    // profile: the resized block is no longer the one sampled
+    if (header_block_is_sampled (*home_ptr)) {
+        heap_profile_record_free (old_payload_ptr);
+        home_ptr->encoding &= ~BLOCK_SAMPLED_MASK;
+    }
+
     // in-place, current block is big enough, either: 
     //  - size is shrinking, we can use the existing block
     //  - size is growing, but we had added padding to the existing block
     if (requested_size <= old_payload_size) {
+        stats.realloc_inplace_hits++;
+        TRACE_REALLOC_END (old_payload_ptr, old_payload_ptr, requested_size);
         return old_payload_ptr;
     }
 
     // scope
-    size_t padded_block_bytes = valid_alloc (requested_size);
+    size_t padded_block_bytes = request_block_bytes (requested_size);
+    if (!padded_block_bytes) {
+        TRACE_REALLOC_END (old_payload_ptr, NULL, requested_size);
+        return NULL;
+    }
+
+    // history: times in a row this block has grown, counting this one
+    realloc_history_entry* history = realloc_history_slot (old_payload_ptr);
+    unsigned long grow_count = 1;
+    if (history->payload_ptr == old_payload_ptr && history->payload_bytes == old_payload_size) {
+        grow_count += history->grow_count;
+    }
 
     // in-place: 
     //  - size is growing, but adjacent blocks are free
@@ -1005,24 +1986,47 @@ void* myrealloc (void *old_payload_ptr, size_t requested_size) {
     
     if (super_block_bytes >= padded_block_bytes) {
         
-        size_t padded_old_size = valid_alloc(old_payload_size);
+        size_t padded_old_size = request_block_bytes (old_payload_size);
 
         realloc_inplace (home_ptr, last_free_coalesced,
                          padded_old_size, super_block_bytes);
+        realloc_history_record (old_payload_ptr, grow_count);
 
+        stats.realloc_inplace_hits++;
+        TRACE_REALLOC_END (old_payload_ptr, old_payload_ptr, requested_size);
         return old_payload_ptr;
     }
+    stats.realloc_inplace_misses++;
 
-    // just malloc:
-    // allocate
-    void* new_ptr = mymalloc (requested_size);
-    assert (new_ptr != NULL);
-    // copy
+    // just malloc, with slack if the block keeps growing:
+    // allocate, without the slack if it does not fit
+    size_t reserve_size = requested_size;
+    if (grow_count >= REALLOC_GROWTH_STREAK) {
+        reserve_size += requested_size / 2;
+    }
+    bool is_large = old_payload_size >= REALLOC_REMAP_BYTES;
+    size_t align_bytes = is_large ? page_bytes : 0;
+    size_t align_offset = is_large ? (uintptr_t) old_payload_ptr % page_bytes : 0;
+    void* new_ptr = heap_alloc (reserve_size, align_bytes, align_offset);
+    if (new_ptr == NULL && reserve_size > requested_size) {
+        new_ptr = heap_alloc (requested_size, align_bytes, align_offset);
+    }
+    if (new_ptr == NULL) {
+        TRACE_REALLOC_END (old_payload_ptr, NULL, requested_size);
+        return NULL;
+    }
+    // copy, or remap the pages of a large block
     size_t size = requested_size > old_payload_size? old_payload_size : requested_size; 
-    memcpy (new_ptr, old_payload_ptr, size);
+    if (!is_large || !realloc_remap (new_ptr, old_payload_ptr, size)) {
+        memcpy (new_ptr, old_payload_ptr, size);
+        stats.realloc_copy_bytes += size;
+    }
     // free
     myfree (old_payload_ptr);
+    history->payload_ptr = NULL;
+    realloc_history_record (new_ptr, grow_count);
     
+    TRACE_REALLOC_END (old_payload_ptr, new_ptr, requested_size);
     return new_ptr;    
 }
 
@@ -1041,7 +2045,7 @@ void dump_heap_headers () {
     printf ("\n==== HEADER DUMP\n");
 
     // heap
-    void* ptr = segment_start; 
+    void* ptr = heap_bottom (); 
     void* heap_end = heap_top (0);
     
     // header
@@ -1052,8 +2056,9 @@ void dump_heap_headers () {
         // current
         read_header (&header, ptr);
         void* payload_ptr = (char*) ptr + block_overhead_bytes();
-        printf ("- client_ptr=%p is_used=%u size=%lu \n", 
-            payload_ptr, header_block_is_used (header), header_payload_size (header));
+        printf ("- client_ptr=%p is_used=%u prev_used=%u size=%lu \n", 
+            payload_ptr, header_block_is_used (header), 
+            header_prev_block_is_used (header), header_payload_size (header));
         
         // next
         ptr = get_next_implicit_header (header, ptr);
@@ -1091,6 +2096,24 @@ bool valid_explicit_heap () {
     if (head_to_tail_block_count != tail_to_head_block_count) {
         return false;
     }
+
+    // quick-listed blocks are held as used, each on the list of its size
+    size_t quick_bytes = 0;
+    for (size_t index = 0; index < QUICK_LIST_COUNT; index++) {
+        curr_header = quick_lists[index];
+        while (curr_header != NULL) {
+            size_t block_bytes = block_overhead_bytes () + block_payload_size (curr_header);
+            if (!header_block_is_used (*curr_header) || 
+                block_bytes != index * ALIGNMENT) {
+                return false;
+            }
+            quick_bytes += block_bytes;
+            curr_header = header_from_link_ref (*quick_list_next (curr_header));
+        }
+    }
+    if (quick_bytes != quick_list_bytes) {
+        return false;
+    }
     
     return true;
 }
@@ -1106,21 +2129,37 @@ bool valid_explicit_heap () {
 bool valid_implicit_heap () {
     
     // heap
-    void* ptr = segment_start; 
+    void* ptr = heap_bottom (); 
     void* heap_end = heap_top (0);
     
     // header
     heap_header header;
+    heap_header footer;
+    bool prev_used = true;
 
     while (within_bounds (ptr, heap_end)) {
         // current
         read_header (&header, ptr);
+        // flag must match the previous block, free blocks need a footer
+        if (header_prev_block_is_used (header) != prev_used) {
+            dump_heap_headers();
+            return false;
+        }
+        prev_used = header_block_is_used (header);
+        size_t size = header_payload_size (header);
+        if (!prev_used) {
+            read_header (&footer, get_block_footer (ptr, block_overhead_bytes () + size));
+            if (header_payload_size (footer) != size) {
+                dump_heap_headers();
+                return false;
+            }
+        }
         // next
         ptr = get_next_implicit_header (header, ptr);
     }
     
     // error?
-    if (ptr != heap_end) {
+    if (ptr != heap_end || prev_used != top_prev_used) {
         dump_heap_headers();
         return false;
     }
@@ -1129,6 +2168,549 @@ bool valid_implicit_heap () {
 }
 
 
+/**
+ * Reports allocator statistics, walking every block for the byte
+ * and free block figures, and copying the running counters.
+ * The walk is by address rather than the free list, as used
+ * blocks keep their list links. Quick-listed blocks count as free
+ * 
+ * Argument
+ *  - out: statistics to fill in
+ * 
+ * Returns: n/a
+ */
+void heap_get_stats (heap_stats* out) {
+
+    *out = stats;
+    out->heap_bytes = bytes_used;
+
+    // heap
+    void* ptr = heap_bottom (); 
+    void* heap_end = heap_top (0);
+
+    // header
+    heap_header header;
+
+    while (within_bounds (ptr, heap_end)) {
+        // current
+        read_header (&header, ptr);
+        size_t size = header_payload_size (header);
+        if (header_block_is_used (header)) {
+            out->live_bytes += size;
+        } else {
+            out->free_bytes += size;
+            out->free_blocks += 1;
+            if (size > out->largest_free_block) {
+                out->largest_free_block = size;
+            }
+        }
+        // next
+        ptr = get_next_implicit_header (header, ptr);
+    }
+
+    // quick-listed blocks are marked used, but hold no client data
+    for (size_t index = 0; index < QUICK_LIST_COUNT; index++) {
+        heap_header* header_ptr = quick_lists[index];
+        while (header_ptr != NULL) {
+            size_t size = block_payload_size (header_ptr);
+            out->live_bytes -= size;
+            out->free_bytes += size;
+            out->free_blocks += 1;
+            if (size > out->largest_free_block) {
+                out->largest_free_block = size;
+            }
+            header_ptr = header_from_link_ref (*quick_list_next (header_ptr));
+        }
+    }
+}
+
+
+/**
+ * Allocate a relocatable block
+ * 
+ * Argument
+ *  - requested_size: number of bytes requested
+ * 
+ * Returns: handle of the block, 0 if none could be allocated
+ */
+heap_handle hmalloc (size_t requested_size) {
+
+    // slot
+    unsigned int slot;
+    if (handles_free_head != 0) {
+        slot = handles_free_head - 1;
+    } else if (handles_used < HANDLE_TABLE_SIZE) {
+        slot = handles_used;
+    } else {
+        return 0;
+    }
+
+    // block
+    void* payload_ptr = mymalloc (requested_size);
+    if (payload_ptr == NULL) {
+        return 0;
+    }
+
+    // update
+    if (slot == handles_used) {
+        handles_used++;
+    } else {
+        handles_free_head = handles[slot].next_free;
+    }
+    handles[slot].payload_ptr = payload_ptr;
+    handles[slot].pins = 0;
+    return slot + 1;
+}
+
+
+/**
+ * Free a relocatable block
+ * 
+ * Argument
+ *  - handle: handle of the block
+ */
+void hfree (heap_handle handle) {
+    handle_entry* entry = &handles[handle - 1];
+    assert (entry->pins == 0);
+    myfree (entry->payload_ptr);
+    entry->payload_ptr = NULL;
+    entry->next_free = handles_free_head;
+    handles_free_head = handle;
+}
+
+
+/**
+ * Pin a relocatable block in place
+ * 
+ * Argument
+ *  - handle: handle of the block
+ * 
+ * Returns: current address of the block
+ */
+void* hlock (heap_handle handle) {
+    handle_entry* entry = &handles[handle - 1];
+    entry->pins++;
+    return entry->payload_ptr;
+}
+
+
+/**
+ * Release a pin on a relocatable block
+ * 
+ * Argument
+ *  - handle: handle of the block
+ */
+void hunlock (heap_handle handle) {
+    handle_entry* entry = &handles[handle - 1];
+    assert (entry->pins > 0);
+    entry->pins--;
+}
+
+
+/**
+ * Orders handle slots by the address of their blocks
+ */
+int compare_handle_addresses (const void* a, const void* b) {
+    void* ptr_a = handles[*(const unsigned int*) a].payload_ptr;
+    void* ptr_b = handles[*(const unsigned int*) b].payload_ptr;
+    return (ptr_a > ptr_b) - (ptr_a < ptr_b);
+}
+
+
+/**
+ * Lists the blocks heap_compact may move, unpinned handle blocks,
+ *  in compact_order by address
+ * 
+ * Returns: number of movable blocks
+ */
+size_t collect_movable_handles () {
+    size_t count = 0;
+    for (unsigned int slot = 0; slot < handles_used; slot++) {
+        if (handles[slot].payload_ptr != NULL && handles[slot].pins == 0) {
+            compact_order[count++] = slot;
+        }
+    }
+    qsort (compact_order, count, sizeof (unsigned int), compare_handle_addresses);
+    return count;
+}
+
+
+#ifdef FREE_BITMAP
+/**
+ * Marks every free block in the bitmap, by a walk of the heap
+ * 
+ * Returns: n/a
+ */
+void rebuild_free_bitmap () {
+
+    free_bitmap_reset ();
+
+    void* ptr = heap_bottom ();
+    void* heap_end = heap_top (0);
+    heap_header header;
+
+    while (within_bounds (ptr, heap_end)) {
+        read_header (&header, ptr);
+        if (!header_block_is_used (header)) {
+            free_bitmap_mark (ptr);
+        }
+        ptr = get_next_implicit_header (header, ptr);
+    }
+}
+
+
+/**
+ * Checks that the bitmap marks exactly the free blocks, by a walk
+ *  of the heap. Quick-listed blocks are used, and not marked
+ * 
+ * Returns: true/false on the bitmap matching
+ */
+bool valid_free_bitmap () {
+
+    void* ptr = heap_bottom ();
+    void* heap_end = heap_top (0);
+    heap_header header;
+    void* marked = free_bitmap_next (ptr, heap_end);
+
+    while (within_bounds (ptr, heap_end)) {
+        read_header (&header, ptr);
+        if (!header_block_is_used (header)) {
+            if (marked != ptr) {
+                return false;
+            }
+            marked = free_bitmap_next ((char*) ptr + 1, heap_end);
+        }
+        ptr = get_next_implicit_header (header, ptr);
+    }
+    return marked == NULL;
+}
+#endif
+
+
+/**
+ * Restores the free block list, footers and previous-block flags
+ *  by a walk of the heap, after heap_compact has moved blocks
+ * 
+ * Returns: n/a
+ */
+void rebuild_free_blocks () {
+
+    free_blocks_head_ptr = NULL;
+    free_blocks_tail_ptr = NULL;
+#ifdef FREE_BITMAP
+    free_bitmap_reset ();
+#endif
+
+    // heap
+    void* ptr = heap_bottom (); 
+    void* heap_end = heap_top (0);
+    bool prev_used = true;
+
+    while (within_bounds (ptr, heap_end)) {
+        // current
+        heap_header* header_ptr = ptr;
+        *header_ptr = header_with_prev_used (*header_ptr, prev_used);
+        prev_used = header_block_is_used (*header_ptr);
+        size_t block_bytes = block_overhead_bytes () + block_payload_size (header_ptr);
+        if (!prev_used) {
+            // append, as the walk is in address order
+            write_free_block_header (header_ptr, block_bytes);
+            heap_link link = link_factory (free_blocks_tail_ptr, NULL);
+            write_link (header_ptr, &link);
+            if (free_blocks_tail_ptr == NULL) {
+                free_blocks_head_ptr = header_ptr;
+            } else {
+                set_next_free_node (free_blocks_tail_ptr, header_ptr);
+            }
+            free_blocks_tail_ptr = header_ptr;
+        }
+        // next
+        ptr = get_next_block_header (header_ptr, block_bytes);
+    }
+    top_prev_used = prev_used;
+}
+
+
+/**
+ * Slides unpinned handle blocks toward the start of the heap. 
+ *  Blocks that cannot move (from mymalloc, or pinned) stay put, 
+ *  and the space between them and the blocks moved below them
+ *  becomes a free block, or pads the last block moved if it is too
+ *  small for one. Free space above the last used block is released
+ * 
+ * Returns: bytes released from the top of the heap
+ */
+size_t heap_compact () {
+
+    quick_list_flush ();
+    size_t old_bytes_used = bytes_used;
+    size_t movable_count = collect_movable_handles ();
+    size_t next_movable = 0;
+
+    // heap
+    char* ptr = heap_bottom (); 
+    char* heap_end = heap_top (0);
+    char* dest = ptr;                   // where the next moved block goes
+    heap_header* last_moved = NULL;     // block just below dest, if it moved
+
+    // header
+    heap_header header;
+
+    while (within_bounds (ptr, heap_end)) {
+        // current
+        read_header (&header, ptr);
+        size_t block_bytes = block_overhead_bytes () + header_payload_size (header);
+        char* next_ptr = ptr + block_bytes;
+        void* payload_ptr = get_block_payload_from_header ((heap_header*) ptr);
+        
+        if (!header_block_is_used (header)) {
+            // free: space to move blocks into
+        } else if (next_movable < movable_count &&
+                   handles[compact_order[next_movable]].payload_ptr == payload_ptr) {
+            // movable: slide down to dest
+            handle_entry* entry = &handles[compact_order[next_movable++]];
+            if (header_block_is_sampled (header)) {
+                heap_profile_record_free (payload_ptr);
+                ((heap_header*) ptr)->encoding &= ~BLOCK_SAMPLED_MASK;
+            }
+            if (dest != ptr) {
+                memmove (dest, ptr, block_bytes);
+                entry->payload_ptr = get_block_payload_from_header ((heap_header*) dest);
+            }
+            last_moved = (heap_header*) dest;
+            dest += block_bytes;
+        } else {
+            // fixed: the gap below it becomes free, or pads the block below
+            size_t gap_bytes = ptr - dest;
+            if (gap_bytes >= min_free_block_size ()) {
+                heap_header gap = header_factory (gap_bytes - block_overhead_bytes (), false);
+                write_header (dest, &gap);
+            } else if (gap_bytes > 0) {
+                assert (last_moved != NULL);
+                size_t padded_bytes = block_payload_size (last_moved) + gap_bytes;
+                heap_header padded = header_factory (padded_bytes, true);
+                write_header (last_moved, &padded);
+            }
+            last_moved = NULL;
+            dest = next_ptr;
+        }
+        
+        // next
+        ptr = next_ptr;
+    }
+
+    // release the top, and fix up what the moves left behind
+    mark_superblock_dirty ();
+    bytes_used = dest - (char*) segment_start;
+    superblock->bytes_used = bytes_used;
+    rebuild_free_blocks ();
+    return old_bytes_used - bytes_used;
+}
+
+
+/**
+ * Offset of a block from segment_start, as saved in the superblock
+ */
+uint64_t superblock_offset (heap_header* header_ptr) {
+    return header_ptr == NULL ? NO_BLOCK_OFFSET : (uint64_t) ((char*) header_ptr - (char*) segment_start);
+}
+
+
+/**
+ * Block at a superblock offset
+ */
+heap_header* superblock_header (uint64_t offset) {
+    return offset == NO_BLOCK_OFFSET ? NULL : (heap_header*) ((char*) segment_start + offset);
+}
+
+
+/**
+ * Checks that block sizes chain from the bottom of the heap to 
+ *  exactly its top, so that a heap left by a crash can be walked
+ * 
+ * Returns: true/false on the walk reaching the top
+ */
+bool heap_walk_reaches_top () {
+
+    char* ptr = heap_bottom ();
+    char* heap_end = heap_top (0);
+
+    while (ptr < heap_end) {
+        size_t block_bytes = block_overhead_bytes () + block_payload_size ((heap_header*) ptr);
+        if (block_bytes < min_free_block_size () || block_bytes > (size_t) (heap_end - ptr)) {
+            return false;
+        }
+        ptr += block_bytes;
+    }
+    return true;
+}
+
+
+/**
+ * Adopts the heap found in the segment by myinit. After a clean 
+ *  shutdown the saved free list is used as is; otherwise it is 
+ *  rebuilt by a walk of the heap. Blocks that were on quick-lists 
+ *  at a crash stay allocated
+ * 
+ * Returns: true/false on the heap validating
+ */
+bool heap_reattach () {
+
+    // out of range, including below the heap start, where it wraps
+    bytes_used = superblock->bytes_used;
+    if (bytes_used - HEAP_START_OFFSET > segment_size - HEAP_START_OFFSET) {
+        return false;
+    }
+
+    if (superblock->clean) {
+        free_blocks_head_ptr = superblock_header (superblock->free_head_offset);
+        free_blocks_tail_ptr = superblock_header (superblock->free_tail_offset);
+        top_prev_used = superblock->top_prev_used;
+#ifdef FREE_BITMAP
+        rebuild_free_bitmap ();
+#endif
+    } else {
+        if (!heap_walk_reaches_top ()) {
+            return false;
+        }
+        rebuild_free_blocks ();
+    }
+    superblock_clean = superblock->clean;
+#ifdef DEFERRED_COALESCING
+    // the last session may have left free blocks unmerged: merge them
+    //  before the heap first grows
+    deferred_frees = 1;
+#endif
+
+    return valid_implicit_heap () && valid_explicit_heap ();
+}
+
+
+/**
+ * Saves the heap state in the superblock, after returning the 
+ *  quick-listed blocks to the free list
+ * 
+ * Returns: n/a
+ */
+void heap_shutdown () {
+
+    quick_list_flush ();
+    superblock->bytes_used = bytes_used;
+    superblock->free_head_offset = superblock_offset (free_blocks_head_ptr);
+    superblock->free_tail_offset = superblock_offset (free_blocks_tail_ptr);
+    superblock->top_prev_used = top_prev_used;
+    superblock->clean = true;
+    superblock_clean = true;
+}
+
+
+/**
+ * Whether the last myinit reattached to an existing heap
+ */
+bool heap_was_reattached () {
+    return reattached;
+}
+
+
+/**
+ * Heap globals saved by heap_snapshot; only the handles in use are
+ *  written. Static, as the handle table is too large for the stack
+ */
+typedef struct {
+    size_t bytes_used;
+    bool top_prev_used;
+    heap_stats stats;
+    heap_header* free_blocks_head_ptr;
+    heap_header* free_blocks_tail_ptr;
+    heap_header* quick_lists[QUICK_LIST_COUNT];
+    size_t quick_list_bytes;
+    size_t deferred_frees;              // 0 without DEFERRED_COALESCING
+    unsigned int handles_used;
+    unsigned int handles_free_head;
+    handle_entry handles[HANDLE_TABLE_SIZE];
+} heap_state;
+
+static heap_state snapshot_state;
+
+
+/**
+ * Writes the heap in use and its globals to a snapshot file
+ * 
+ * Argument
+ *  - path: snapshot file
+ * 
+ * Returns: true/false on success
+ */
+bool heap_snapshot (const char* path) {
+
+    heap_state* state = &snapshot_state;
+    state->bytes_used = bytes_used;
+    state->top_prev_used = top_prev_used;
+    state->stats = stats;
+    state->free_blocks_head_ptr = free_blocks_head_ptr;
+    state->free_blocks_tail_ptr = free_blocks_tail_ptr;
+    memcpy (state->quick_lists, quick_lists, sizeof (quick_lists));
+    state->quick_list_bytes = quick_list_bytes;
+#ifdef DEFERRED_COALESCING
+    state->deferred_frees = deferred_frees;
+#else
+    state->deferred_frees = 0;
+#endif
+    state->handles_used = handles_used;
+    state->handles_free_head = handles_free_head;
+    memcpy (state->handles, handles, handles_used * sizeof (handle_entry));
+
+    size_t state_bytes = offsetof (heap_state, handles) + handles_used * sizeof (handle_entry);
+    return write_heap_snapshot (path, segment_start, segment_size, bytes_used, state, state_bytes);
+}
+
+
+/**
+ * Maps a snapshot file over the heap and restores its globals. 
+ *  The superblock, which is past the snapshot, is brought up to 
+ *  date, and the heap profile starts over
+ * 
+ * Argument
+ *  - path: snapshot file
+ * 
+ * Returns: true/false on success
+ */
+bool heap_restore (const char* path) {
+
+    heap_state* state = &snapshot_state;
+    size_t state_bytes = sizeof (heap_state);
+    if (!map_heap_snapshot (path, segment_start, segment_size, state, &state_bytes) ||
+        state_bytes < offsetof (heap_state, handles) ||
+        state_bytes != offsetof (heap_state, handles) + state->handles_used * sizeof (handle_entry)) {
+        return false;
+    }
+
+    bytes_used = state->bytes_used;
+    top_prev_used = state->top_prev_used;
+    stats = state->stats;
+    free_blocks_head_ptr = state->free_blocks_head_ptr;
+    free_blocks_tail_ptr = state->free_blocks_tail_ptr;
+    memcpy (quick_lists, state->quick_lists, sizeof (quick_lists));
+    quick_list_bytes = state->quick_list_bytes;
+#ifdef DEFERRED_COALESCING
+    deferred_frees = state->deferred_frees;
+#endif
+    memset (realloc_history, 0, sizeof (realloc_history));
+    handles_used = state->handles_used;
+    handles_free_head = state->handles_free_head;
+    memcpy (handles, state->handles, handles_used * sizeof (handle_entry));
+
+    superblock->bytes_used = bytes_used;
+    superblock->clean = false;
+    superblock_clean = false;
+    heap_profile_reset ();
+#ifdef FREE_BITMAP
+    rebuild_free_bitmap ();
+#endif
+    return true;
+}
+
+
 /**
  * Asserts the validity of the heap state
  * 
@@ -1165,6 +2747,14 @@ bool validate_heap () {
         breakpoint();   
         return false;        
     }
+
+#ifdef FREE_BITMAP
+    if (!valid_free_bitmap ()) {
+        printf ("\n Oops! Free bitmap does not match the heap!\n");
+        breakpoint();   
+        return false;        
+    }
+#endif
     
     return true;
 }
@@ -0,0 +1,143 @@
+/* File: free_bitmap.c
+ * -------------------
+ * Two-level free-block bitmap. Level 0 has a bit per granule; level 1 a
+ * bit per level 0 word, set while that word is nonzero, so a 32 KiB stretch
+ * of heap without free blocks costs one bit test to skip. Both levels are
+ * one anonymous mapping sized for the whole segment: pages are only
+ * backed once marked, and reset clears no further than the highest word
+ * ever marked.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "free_bitmap.h"
+
+#define WORD_BITS 64
+
+static char *base;                  // heap start
+static uint64_t *words;             // level 0: a bit per granule
+static uint64_t *summary;           // level 1: a bit per level 0 word
+static size_t mapped_bytes;         // of words and summary together
+static size_t words_touched;        // level 0 words that may be nonzero
+
+
+/* Function: round_words
+ * ---------------------
+ * Returns the number of 64-bit words needed for bits bits.
+ */
+static size_t round_words(size_t bits) {
+    return (bits + WORD_BITS - 1) / WORD_BITS;
+}
+
+bool free_bitmap_init(void *heap_start, size_t heap_size) {
+    size_t heap_words = round_words(heap_size / FREE_BITMAP_GRANULE + 1);
+    size_t wanted_bytes = (heap_words + round_words(heap_words)) * sizeof(uint64_t);
+
+    if (words != NULL && wanted_bytes == mapped_bytes) {
+        free_bitmap_reset();
+    } else {
+        if (words != NULL) {
+            munmap(words, mapped_bytes);
+            words = NULL;
+        }
+        void *map = mmap(NULL, wanted_bytes, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        words = map;
+        mapped_bytes = wanted_bytes;
+        words_touched = 0;
+    }
+    base = heap_start;
+    summary = words + heap_words;
+    return true;
+}
+
+void free_bitmap_reset(void) {
+    memset(words, 0, words_touched * sizeof(uint64_t));
+    memset(summary, 0, round_words(words_touched) * sizeof(uint64_t));
+    words_touched = 0;
+}
+
+void free_bitmap_mark(void *block) {
+    size_t granule = ((char *)block - base) / FREE_BITMAP_GRANULE;
+    size_t word = granule / WORD_BITS;
+    words[word] |= 1UL << (granule % WORD_BITS);
+    summary[word / WORD_BITS] |= 1UL << (word % WORD_BITS);
+    if (word >= words_touched) {
+        words_touched = word + 1;
+    }
+}
+
+void free_bitmap_unmark(void *block) {
+    size_t granule = ((char *)block - base) / FREE_BITMAP_GRANULE;
+    size_t word = granule / WORD_BITS;
+    words[word] &= ~(1UL << (granule % WORD_BITS));
+    if (words[word] == 0) {
+        summary[word / WORD_BITS] &= ~(1UL << (word % WORD_BITS));
+    }
+}
+
+void free_bitmap_unmark_range(void *start, void *end) {
+    size_t first = ((char *)start - base) / FREE_BITMAP_GRANULE;
+    size_t last = ((char *)end - base + FREE_BITMAP_GRANULE - 1) / FREE_BITMAP_GRANULE;
+    if (last > words_touched * WORD_BITS) {
+        last = words_touched * WORD_BITS;
+    }
+    while (first < last) {
+        size_t word = first / WORD_BITS;
+        size_t stop = (word + 1) * WORD_BITS < last ? (word + 1) * WORD_BITS : last;
+        uint64_t mask = ~0UL << (first % WORD_BITS);
+        if (stop % WORD_BITS != 0) {
+            mask &= ~(~0UL << (stop % WORD_BITS));
+        }
+        words[word] &= ~mask;
+        if (words[word] == 0) {
+            summary[word / WORD_BITS] &= ~(1UL << (word % WORD_BITS));
+        }
+        first = stop;
+    }
+}
+
+/* Function: next_marked_word
+ * --------------------------
+ * Returns the first nonzero level 0 word at or after word, from the
+ * summary, or words_touched if there is none.
+ */
+static size_t next_marked_word(size_t word) {
+    if (word >= words_touched) {
+        return words_touched;
+    }
+    size_t index = word / WORD_BITS;
+    uint64_t bits = summary[index] & (~0UL << (word % WORD_BITS));
+    while (bits == 0) {
+        if (++index * WORD_BITS >= words_touched) {
+            return words_touched;
+        }
+        bits = summary[index];
+    }
+    size_t found = index * WORD_BITS + __builtin_ctzl(bits);
+    return found < words_touched ? found : words_touched;
+}
+
+void *free_bitmap_next(void *from, void *end) {
+    size_t granule = ((char *)from - base + FREE_BITMAP_GRANULE - 1) / FREE_BITMAP_GRANULE;
+    size_t limit = ((char *)end - base + FREE_BITMAP_GRANULE - 1) / FREE_BITMAP_GRANULE;
+    size_t word = granule / WORD_BITS;
+    if (word >= words_touched) {
+        return NULL;
+    }
+
+    uint64_t bits = words[word] & (~0UL << (granule % WORD_BITS));
+    while (bits == 0) {
+        word = next_marked_word(word + 1);
+        if (word == words_touched) {
+            return NULL;
+        }
+        bits = words[word];
+    }
+    granule = word * WORD_BITS + __builtin_ctzl(bits);
+    return granule < limit ? base + granule * FREE_BITMAP_GRANULE : NULL;
+}
@@ -0,0 +1,53 @@
+/* File: free_bitmap.h
+ * -------------------
+ * Interface to the free-block bitmap. One bit per 8-byte granule of the
+ * heap marks the granules where a free block starts, and a summary level
+ * has one bit per bitmap word that has any bit set, so the next free block
+ * is found with a few count-trailing-zeros over sequential words rather
+ * than by following headers or list links. The allocator marks and unmarks
+ * blocks as their headers change; the bitmap knows nothing of block sizes.
+ */
+
+#ifndef _FREE_BITMAP_H_
+#define _FREE_BITMAP_H_
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+// bytes of heap per bitmap bit; block starts must be this far apart
+#define FREE_BITMAP_GRANULE 8
+
+
+/* Function: free_bitmap_init
+ * --------------------------
+ * Covers heap_size bytes from heap_start, which must be granule aligned,
+ * with no block marked. The bitmap is reserved with mmap and only the pages
+ * that get marked take memory. Returns false if it cannot be reserved.
+ */
+bool free_bitmap_init(void *heap_start, size_t heap_size);
+
+
+/* Function: free_bitmap_reset
+ * ---------------------------
+ * Unmarks every block.
+ */
+void free_bitmap_reset(void);
+
+
+/* Functions: free_bitmap_mark, free_bitmap_unmark, free_bitmap_unmark_range
+ * --------------------------------------------------------------------------
+ * Mark or unmark the block starting at block; unmark_range unmarks every
+ * granule in [start, end).
+ */
+void free_bitmap_mark(void *block);
+void free_bitmap_unmark(void *block);
+void free_bitmap_unmark_range(void *start, void *end);
+
+
+/* Function: free_bitmap_next
+ * --------------------------
+ * Returns the first marked block at or after from and before end, or NULL.
+ */
+void *free_bitmap_next(void *from, void *end);
+
+
+#endif
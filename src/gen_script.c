@@ -0,0 +1,355 @@
+/*
+ * File: gen_script.c
+ * ------------------
+ * Generates synthetic allocator scripts, in the test harness format, from
+ * a workload description:
+ *
+ *      gen_script [-n OPS] [-p PEAK_BYTES] [-z SIZE_DIST] [-l LIFETIME_DIST]
+ *                 [-r PROB:RATIO] [-s SEED] [-o PATH]
+ *
+ *  -n  total number of requests (default 1000000)
+ *  -p  peak live payload bytes; when an allocation would exceed it the
+ *      block closest to the end of its life is freed first (default 16 MiB)
+ *  -z  distribution of request sizes (default power:1.2:8:65536)
+ *  -l  distribution of block lifetimes, in requests (default exp:1000)
+ *  -r  probability that a request resizes a random live block, and the
+ *      ratio it grows by (default 0.05:1.5)
+ *  -s  seed; the same arguments and seed always give the same script
+ *  -o  output path (default stdout)
+ *
+ * Distributions are written as:
+ *      fixed:N                 always N
+ *      uniform:MIN:MAX         uniform in [MIN, MAX]
+ *      exp:MEAN                exponential with the given mean
+ *      power:ALPHA:MIN:MAX     bounded power law (Pareto) on [MIN, MAX]
+ *      bimodal:A:B:FRAC        A with probability FRAC, else B, each +-25%
+ *      hist:PATH               the alloc/realloc sizes of an existing script
+ *
+ * Ids of freed blocks are reused, so a script needs as many ids as its
+ * peak number of live blocks and the harness stays fast on long scripts.
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "script.h"
+
+
+/* TYPE DECLARATIONS */
+
+
+enum dist_kind {
+    DIST_FIXED,
+    DIST_UNIFORM,
+    DIST_EXP,
+    DIST_POWER,
+    DIST_BIMODAL,
+    DIST_HIST
+};
+
+// a parsed distribution spec
+typedef struct {
+    enum dist_kind kind;
+    double a, b, c;         // parameters, in the order of the spec
+    size_t *values;         // sizes sampled from, for DIST_HIST
+    int num_values;
+} dist_t;
+
+// a live block, kept in a min-heap ordered by the request it dies at
+typedef struct {
+    long death;
+    int id;
+    size_t size;
+} live_t;
+
+
+/* CONSTANTS */
+
+
+const long DEFAULT_OPS = 1000000;
+
+const size_t DEFAULT_PEAK_BYTES = 16 << 20;
+
+const char *DEFAULT_SIZE_DIST = "power:1.2:8:65536";
+
+const char *DEFAULT_LIFETIME_DIST = "exp:1000";
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static dist_t parse_dist(const char *spec);
+static double sample_dist(dist_t *dist);
+static double next_uniform();
+static void heap_push(live_t block);
+static live_t heap_pop();
+static void heap_sift_down(int i);
+
+
+/* Generator state */
+static uint64_t rng_state;
+static live_t *live;
+static int num_live;
+static int live_capacity;
+static int *free_ids;
+static int num_free_ids;
+static int num_ids;
+
+
+/* Function: main
+ * --------------
+ * Parses the workload description and writes the generated script.
+ */
+int main(int argc, char *argv[]) {
+    int c;
+    long num_ops = DEFAULT_OPS;
+    size_t peak_bytes = DEFAULT_PEAK_BYTES;
+    const char *size_spec = DEFAULT_SIZE_DIST;
+    const char *lifetime_spec = DEFAULT_LIFETIME_DIST;
+    double realloc_prob = 0.05, growth_ratio = 1.5;
+    uint64_t seed = 1;
+    const char *out_path = NULL;
+
+    while ((c = getopt(argc, argv, "n:p:z:l:r:s:o:")) != EOF) {
+        if (c == 'n') {
+            num_ops = atol(optarg);
+        } else if (c == 'p') {
+            peak_bytes = strtoull(optarg, NULL, 10);
+        } else if (c == 'z') {
+            size_spec = optarg;
+        } else if (c == 'l') {
+            lifetime_spec = optarg;
+        } else if (c == 'r') {
+            if (sscanf(optarg, "%lf:%lf", &realloc_prob, &growth_ratio) != 2) {
+                error(1, 0, "Realloc spec must be PROB:RATIO.");
+            }
+        } else if (c == 's') {
+            seed = strtoull(optarg, NULL, 10);
+        } else if (c == 'o') {
+            out_path = optarg;
+        } else {
+            error(1, 0, "Unknown option. See the comment at the top of gen_script.c.");
+        }
+    }
+    if (num_ops <= 0 || peak_bytes == 0) {
+        error(1, 0, "Number of requests and peak bytes must be positive.");
+    }
+
+    dist_t size_dist = parse_dist(size_spec);
+    dist_t lifetime_dist = parse_dist(lifetime_spec);
+    rng_state = seed ? seed : 1;
+
+    FILE *fp = out_path ? fopen(out_path, "w") : stdout;
+    if (fp == NULL) {
+        error(1, 0, "Could not open output file \"%s\".", out_path);
+    }
+    fprintf(fp, "# Generated: gen_script -n %ld -p %zu -z %s -l %s -r %g:%g -s %llu\n",
+        num_ops, peak_bytes, size_spec, lifetime_spec, realloc_prob, growth_ratio,
+        (unsigned long long)seed);
+
+    size_t live_bytes = 0;
+    for (long now = 0; now < num_ops; now++) {
+
+        // blocks whose lifetime is over are freed first
+        if (num_live > 0 && live[0].death <= now) {
+            live_t block = heap_pop();
+            fprintf(fp, "f %d\n", block.id);
+            free_ids[num_free_ids++] = block.id;
+            live_bytes -= block.size;
+            continue;
+        }
+
+        // grow a random live block
+        if (num_live > 0 && next_uniform() < realloc_prob) {
+            live_t *block = &live[(int)(next_uniform() * num_live) % num_live];
+            size_t new_size = ceil(block->size * growth_ratio);
+            if (new_size > MAX_REQUEST_SIZE) {
+                new_size = MAX_REQUEST_SIZE;
+            }
+            if (live_bytes - block->size + new_size <= peak_bytes) {
+                fprintf(fp, "r %d %zu\n", block->id, new_size);
+                live_bytes += new_size - block->size;
+                block->size = new_size;
+                continue;
+            }
+        }
+
+        double sampled = sample_dist(&size_dist);
+        size_t size = sampled < 1 ? 1 : sampled > MAX_REQUEST_SIZE ? MAX_REQUEST_SIZE : sampled;
+
+        // make room under the peak by ending the shortest-lived block early
+        if (num_live > 0 && live_bytes + size > peak_bytes) {
+            live_t block = heap_pop();
+            fprintf(fp, "f %d\n", block.id);
+            free_ids[num_free_ids++] = block.id;
+            live_bytes -= block.size;
+            continue;
+        }
+
+        live_t block = {.death = now + 1 + (long)sample_dist(&lifetime_dist), .size = size};
+        block.id = num_free_ids > 0 ? free_ids[--num_free_ids] : num_ids++;
+        fprintf(fp, "a %d %zu\n", block.id, size);
+        heap_push(block);
+        live_bytes += size;
+    }
+
+    if (fp != stdout && fclose(fp) != 0) {
+        error(1, 0, "Could not write output file \"%s\".", out_path);
+    }
+    free(live);
+    free(free_ids);
+    free(size_dist.values);
+    free(lifetime_dist.values);
+    return 0;
+}
+
+/* Function: parse_dist
+ * --------------------
+ * Parses a distribution spec (see the top of this file), exiting with an
+ * error if it is malformed.
+ */
+static dist_t parse_dist(const char *spec) {
+    dist_t dist = {.values = NULL, .num_values = 0};
+    int nparsed = 0;
+    if (strncmp(spec, "fixed:", 6) == 0) {
+        dist.kind = DIST_FIXED;
+        nparsed = sscanf(spec + 6, "%lf", &dist.a) == 1;
+    } else if (strncmp(spec, "uniform:", 8) == 0) {
+        dist.kind = DIST_UNIFORM;
+        nparsed = sscanf(spec + 8, "%lf:%lf", &dist.a, &dist.b) == 2 && dist.a <= dist.b;
+    } else if (strncmp(spec, "exp:", 4) == 0) {
+        dist.kind = DIST_EXP;
+        nparsed = sscanf(spec + 4, "%lf", &dist.a) == 1 && dist.a > 0;
+    } else if (strncmp(spec, "power:", 6) == 0) {
+        dist.kind = DIST_POWER;
+        nparsed = sscanf(spec + 6, "%lf:%lf:%lf", &dist.a, &dist.b, &dist.c) == 3 &&
+            dist.a > 0 && dist.b > 0 && dist.b < dist.c;
+    } else if (strncmp(spec, "bimodal:", 8) == 0) {
+        dist.kind = DIST_BIMODAL;
+        nparsed = sscanf(spec + 8, "%lf:%lf:%lf", &dist.a, &dist.b, &dist.c) == 3 &&
+            dist.c >= 0 && dist.c <= 1;
+    } else if (strncmp(spec, "hist:", 5) == 0) {
+        dist.kind = DIST_HIST;
+        script_t script = parse_script(spec + 5);
+        dist.values = malloc(script.num_ops * sizeof(size_t));
+        if (dist.values == NULL) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        for (int i = 0; i < script.num_ops; i++) {
+            if (script.ops[i].op != FREE && script.ops[i].size > 0) {
+                dist.values[dist.num_values++] = script.ops[i].size;
+            }
+        }
+        free(script.ops);
+        free(script.blocks);
+        nparsed = dist.num_values > 0;
+    }
+    if (!nparsed) {
+        error(1, 0, "Malformed distribution \"%s\".", spec);
+    }
+    return dist;
+}
+
+/* Function: sample_dist
+ * ---------------------
+ * Draws one value from a distribution.
+ */
+static double sample_dist(dist_t *dist) {
+    double u = next_uniform();
+    switch (dist->kind) {
+        case DIST_FIXED:
+            return dist->a;
+        case DIST_UNIFORM:
+            return dist->a + u * (dist->b - dist->a + 1);
+        case DIST_EXP:
+            return -log(1 - u) * dist->a;
+        case DIST_POWER: {
+            // inverse CDF of the Pareto distribution bounded to [b, c]
+            double alpha = dist->a;
+            double low = pow(dist->b, alpha), high = pow(dist->c, alpha);
+            return pow(-(u * high - u * low - high) / (high * low), -1 / alpha);
+        }
+        case DIST_BIMODAL: {
+            double mode = next_uniform() < dist->c ? dist->a : dist->b;
+            return mode * (0.75 + 0.5 * u);
+        }
+        case DIST_HIST:
+            return dist->values[(int)(u * dist->num_values) % dist->num_values];
+    }
+    return 0;
+}
+
+/* Function: next_uniform
+ * ----------------------
+ * Returns a uniform double in [0, 1) from a xorshift64* generator, so
+ * scripts are reproducible across platforms and C libraries.
+ */
+static double next_uniform() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+/* Function: heap_push
+ * -------------------
+ * Adds a live block to the min-heap ordered by death, growing the heap
+ * and the id stack as needed.
+ */
+static void heap_push(live_t block) {
+    if (num_live == live_capacity) {
+        live_capacity = live_capacity ? 2 * live_capacity : 1024;
+        live = realloc(live, live_capacity * sizeof(live_t));
+        free_ids = realloc(free_ids, live_capacity * sizeof(int));
+        if (live == NULL || free_ids == NULL) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+    }
+    int i = num_live++;
+    while (i > 0 && live[(i - 1) / 2].death > block.death) {
+        live[i] = live[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    live[i] = block;
+}
+
+/* Function: heap_pop
+ * ------------------
+ * Removes and returns the live block that dies first.
+ */
+static live_t heap_pop() {
+    live_t top = live[0];
+    live[0] = live[--num_live];
+    heap_sift_down(0);
+    return top;
+}
+
+/* Function: heap_sift_down
+ * ------------------------
+ * Restores the heap order below index i.
+ */
+static void heap_sift_down(int i) {
+    while (true) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < num_live && live[left].death < live[smallest].death) {
+            smallest = left;
+        }
+        if (right < num_live && live[right].death < live[smallest].death) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        live_t tmp = live[i];
+        live[i] = live[smallest];
+        live[smallest] = tmp;
+        i = smallest;
+    }
+}
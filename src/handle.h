@@ -0,0 +1,54 @@
+/* File: handle.h
+ * --------------
+ * Relocatable handle interface for the explicit allocator. A block
+ * allocated with hmalloc is reached through its handle; hlock pins it and
+ * returns its current address, which stays valid until the matching
+ * hunlock. heap_compact slides every unpinned handle block toward the
+ * start of the segment, leaving blocks from mymalloc and pinned handles in
+ * place, and releases the free space left at the top of the heap.
+ */
+
+#ifndef _HANDLE_H_
+#define _HANDLE_H_
+#include <stddef.h>  // for size_t
+
+// maximum number of live handles
+#define HANDLE_TABLE_SIZE 65536
+
+// 0 is never a valid handle
+typedef unsigned int heap_handle;
+
+
+/* Function: hmalloc
+ * -----------------
+ * Allocates a relocatable block of size bytes. Returns its handle, or 0 if
+ * the heap or the handle table is exhausted.
+ */
+heap_handle hmalloc(size_t size);
+
+
+/* Function: hfree
+ * ---------------
+ * Frees the block of a handle, which must not be locked.
+ */
+void hfree(heap_handle handle);
+
+
+/* Functions: hlock, hunlock
+ * -------------------------
+ * hlock pins the handle's block and returns its address; locks nest, and
+ * the block may move again once every hlock has had its hunlock.
+ */
+void *hlock(heap_handle handle);
+void hunlock(heap_handle handle);
+
+
+/* Function: heap_compact
+ * ----------------------
+ * Moves unpinned handle blocks down over free space and shrinks the heap.
+ * Returns the number of bytes released from the top of the heap.
+ */
+size_t heap_compact(void);
+
+
+#endif
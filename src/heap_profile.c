@@ -0,0 +1,213 @@
+/* File: heap_profile.c
+ * --------------------
+ * Sampling heap profiler, after tcmalloc's. Sample distances are drawn from
+ * an exponential distribution, so every allocated byte is equally likely to
+ * trigger a sample and pprof can scale the counts back up. Stacks live in
+ * a fixed-size open-addressing table keyed by a hash of the return
+ * addresses; a second fixed-size table maps each live sampled block to its
+ * stack so frees can be attributed. Nothing here allocates memory, and
+ * samples that do not fit in the tables are dropped.
+ */
+
+#include <execinfo.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "heap_profile.h"
+
+#define PROFILE_MAX_DEPTH       32
+#define PROFILE_SKIP_FRAMES     1       // heap_profile_record_alloc itself
+#define PROFILE_STACK_SLOTS     4096    // must be a power of 2
+#define PROFILE_LIVE_SLOTS      16384   // must be a power of 2
+#define PROFILE_LIVE_TOMBSTONE  ((void *)1)
+
+// aggregated samples for one call stack
+typedef struct {
+    uint64_t hash;          // 0 if the slot is empty
+    int depth;
+    void *pcs[PROFILE_MAX_DEPTH];
+    size_t alloc_count;
+    size_t alloc_bytes;
+    size_t inuse_count;
+    size_t inuse_bytes;
+} profile_stack;
+
+// sampled block still in use
+typedef struct {
+    void *ptr;              // NULL if empty, PROFILE_LIVE_TOMBSTONE if removed
+    size_t size;
+    int stack;
+} profile_live;
+
+long heap_profile_countdown = LONG_MAX;
+
+static size_t sample_period = 0;
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static profile_stack stacks[PROFILE_STACK_SLOTS];
+static profile_live live[PROFILE_LIVE_SLOTS];
+
+
+/* Function: next_sample_distance
+ * ------------------------------
+ * Draws the bytes until the next sample from an exponential distribution
+ * with mean sample_period, using a xorshift64* generator.
+ */
+static long next_sample_distance() {
+    if (sample_period == 0) {
+        return LONG_MAX;
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    uint64_t bits = (rng_state * 0x2545F4914F6CDD1DULL) >> 11;
+    double u = (bits + 1.0) / (double)(1ULL << 53);     // in (0, 1]
+    double distance = -log(u) * sample_period;
+    return distance < LONG_MAX / 2 ? (long)distance + 1 : LONG_MAX / 2;
+}
+
+/* Function: hash_pointer
+ * ----------------------
+ * Mixes a pointer into a table index seed.
+ */
+static uint64_t hash_pointer(const void *ptr) {
+    uint64_t h = (uintptr_t)ptr;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Function: find_stack
+ * --------------------
+ * Returns the index of the table slot for the given stack, claiming an
+ * empty slot if the stack has not been seen yet, or -1 if the table is full.
+ */
+static int find_stack(void **pcs, int depth) {
+    uint64_t hash = 14695981039346656037ULL;    // FNV-1a offset basis
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t)pcs[i]) * 1099511628211ULL;
+    }
+    if (hash == 0) {
+        hash = 1;
+    }
+
+    for (size_t probe = 0; probe < PROFILE_STACK_SLOTS; probe++) {
+        int slot = (hash + probe) & (PROFILE_STACK_SLOTS - 1);
+        profile_stack *stack = &stacks[slot];
+        if (stack->hash == 0) {
+            stack->hash = hash;
+            stack->depth = depth;
+            memcpy(stack->pcs, pcs, depth * sizeof(void *));
+            return slot;
+        }
+        if (stack->hash == hash && stack->depth == depth &&
+            memcmp(stack->pcs, pcs, depth * sizeof(void *)) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void heap_profile_start(size_t period) {
+    sample_period = period;
+    heap_profile_countdown = next_sample_distance();
+}
+
+void heap_profile_reset(void) {
+    memset(stacks, 0, sizeof(stacks));
+    memset(live, 0, sizeof(live));
+    heap_profile_countdown = next_sample_distance();
+}
+
+bool heap_profile_record_alloc(void *ptr, size_t size) {
+    heap_profile_countdown = next_sample_distance();
+    if (sample_period == 0) {
+        return false;
+    }
+
+    void *pcs[PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES];
+    int depth = backtrace(pcs, PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES);
+    if (depth <= PROFILE_SKIP_FRAMES) {
+        return false;
+    }
+    int slot = find_stack(pcs + PROFILE_SKIP_FRAMES, depth - PROFILE_SKIP_FRAMES);
+    if (slot < 0) {
+        return false;
+    }
+
+    uint64_t hash = hash_pointer(ptr);
+    for (size_t probe = 0; probe < PROFILE_LIVE_SLOTS; probe++) {
+        profile_live *entry = &live[(hash + probe) & (PROFILE_LIVE_SLOTS - 1)];
+        if (entry->ptr == NULL || entry->ptr == PROFILE_LIVE_TOMBSTONE) {
+            *entry = (profile_live){.ptr = ptr, .size = size, .stack = slot};
+            stacks[slot].alloc_count++;
+            stacks[slot].alloc_bytes += size;
+            stacks[slot].inuse_count++;
+            stacks[slot].inuse_bytes += size;
+            return true;
+        }
+    }
+    return false;
+}
+
+void heap_profile_record_free(void *ptr) {
+    uint64_t hash = hash_pointer(ptr);
+    for (size_t probe = 0; probe < PROFILE_LIVE_SLOTS; probe++) {
+        profile_live *entry = &live[(hash + probe) & (PROFILE_LIVE_SLOTS - 1)];
+        if (entry->ptr == NULL) {
+            return;
+        }
+        if (entry->ptr == ptr) {
+            stacks[entry->stack].inuse_count--;
+            stacks[entry->stack].inuse_bytes -= entry->size;
+            entry->ptr = PROFILE_LIVE_TOMBSTONE;
+            return;
+        }
+    }
+}
+
+bool heap_profile_dump(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
+    }
+
+    size_t inuse_count = 0, inuse_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (int i = 0; i < PROFILE_STACK_SLOTS; i++) {
+        inuse_count += stacks[i].inuse_count;
+        inuse_bytes += stacks[i].inuse_bytes;
+        alloc_count += stacks[i].alloc_count;
+        alloc_bytes += stacks[i].alloc_bytes;
+    }
+    fprintf(fp, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+        inuse_count, inuse_bytes, alloc_count, alloc_bytes, sample_period);
+
+    for (int i = 0; i < PROFILE_STACK_SLOTS; i++) {
+        profile_stack *stack = &stacks[i];
+        if (stack->hash == 0) {
+            continue;
+        }
+        fprintf(fp, "%zu: %zu [%zu: %zu] @", stack->inuse_count, stack->inuse_bytes,
+            stack->alloc_count, stack->alloc_bytes);
+        for (int j = 0; j < stack->depth; j++) {
+            fprintf(fp, " %p", stack->pcs[j]);
+        }
+        fprintf(fp, "\n");
+    }
+
+    // pprof symbolizes the addresses using the process memory map
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps != NULL) {
+        char buffer[4096];
+        size_t nread;
+        while ((nread = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+            fwrite(buffer, 1, nread, fp);
+        }
+        fclose(maps);
+    }
+
+    return fclose(fp) == 0;
+}
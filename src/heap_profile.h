@@ -0,0 +1,72 @@
+/* File: heap_profile.h
+ * --------------------
+ * Interface to the sampling heap profiler. On average one allocation per
+ * sample period bytes records its call stack; samples are aggregated by
+ * stack and can be dumped in the legacy pprof heap profile format, e.g.
+ *      pprof --text test_explicit heap.prof
+ * The allocator decrements heap_profile_countdown on every allocation and
+ * only calls into the profiler when it goes negative.
+ */
+
+#ifndef _HEAP_PROFILE_H_
+#define _HEAP_PROFILE_H_
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+// default mean number of allocated bytes between samples
+#define HEAP_PROFILE_DEFAULT_PERIOD (512 * 1024)
+
+// bytes left until the next sample; never reaches zero while stopped
+extern long heap_profile_countdown;
+
+
+/* Function: heap_profile_should_sample
+ * ------------------------------------
+ * Fast path for the allocator: charges size bytes to the countdown and
+ * returns true when this allocation should be recorded.
+ */
+static inline bool heap_profile_should_sample(size_t size) {
+    return (heap_profile_countdown -= (long)size) < 0;
+}
+
+
+/* Function: heap_profile_start
+ * ----------------------------
+ * Starts sampling with the given mean period in bytes, or stops sampling
+ * if period is 0. Samples taken so far are kept.
+ */
+void heap_profile_start(size_t period);
+
+
+/* Function: heap_profile_reset
+ * ----------------------------
+ * Discards all samples, e.g. when the allocator is reset by myinit.
+ */
+void heap_profile_reset(void);
+
+
+/* Function: heap_profile_record_alloc
+ * -----------------------------------
+ * Records the current call stack for the block at ptr, and draws the next
+ * sample distance. Returns true if the block is tracked, in which case the
+ * allocator must report it to heap_profile_record_free when released.
+ */
+bool heap_profile_record_alloc(void *ptr, size_t size);
+
+
+/* Function: heap_profile_record_free
+ * ----------------------------------
+ * Removes a tracked block from the in-use figures of its stack.
+ */
+void heap_profile_record_free(void *ptr);
+
+
+/* Function: heap_profile_dump
+ * ---------------------------
+ * Writes the profile to path in pprof's legacy heap format. Returns false
+ * if the file could not be written.
+ */
+bool heap_profile_dump(const char *path);
+
+
+#endif
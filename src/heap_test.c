@@ -0,0 +1,408 @@
+/*
+ * File: heap_test.c
+ * -----------------
+ * Checks the interfaces the explicit allocator adds beyond allocator.h,
+ * which scripts cannot exercise. Each check runs on a fresh heap, fills the
+ * blocks it keeps with a pattern, and verifies the pattern after the
+ * operations that could clobber or move them.
+ *
+ *      heap_test_explicit [check...]
+ *
+ * With no arguments, every check runs. Exits with the number of failed
+ * checks. The persistence check runs this program again for each of its
+ * stages, as a new process has to reattach the heap:
+ *
+ *      heap_test_explicit -stage create|crash|reopen path [root]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "handle.h"
+#include "persist.h"
+#include "placement.h"
+#include "segment.h"
+#include "test_util.h"
+
+
+/* CONSTANTS */
+
+
+const int COMPACT_HANDLES = 200;
+
+const size_t PERSIST_HEAP_SIZE = 1 << 20;
+
+const size_t FULL_HEAP_SIZE = 36000;
+
+#define ISOLATED_BLOCKS 400
+
+#define MERGE_BLOCKS 8
+
+const size_t MERGE_BLOCK_SIZE = 1000;
+
+
+/* The program, to run the stages of the persistence check */
+static const char *program_path;
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static bool check_compaction(void);
+static bool check_persistence(void);
+static bool check_isolation(void);
+static bool lines_isolated(void **ptrs, size_t *sizes, bool *isolated, int count);
+static bool check_realloc_full(void);
+static bool within_heap(const void *ptr, size_t size);
+static bool check_restore_merge(void);
+static bool run_stage(const char *stage, const char *path, const char *root, char *output,
+    size_t output_len);
+static int persist_stage(const char *stage, const char *path, const char *root_arg);
+
+
+static const check_t CHECKS[] = {
+    {"compaction", check_compaction},
+    {"persistence", check_persistence},
+    {"isolation", check_isolation},
+    {"realloc near a full heap", check_realloc_full},
+    {"merging after a restore", check_restore_merge},
+};
+
+
+/* Function: main
+ * --------------
+ * Runs the checks named on the command line, or all of them.
+ */
+int main(int argc, char *argv[]) {
+    program_path = argv[0];
+    if (argc >= 4 && strcmp(argv[1], "-stage") == 0) {
+        return persist_stage(argv[2], argv[3], argc > 4 ? argv[4] : NULL);
+    }
+    return run_checks(CHECKS, sizeof(CHECKS) / sizeof(CHECKS[0]), argv + 1, argc - 1);
+}
+
+/* Function: check_compaction
+ * --------------------------
+ * Interleaves handle blocks with blocks from mymalloc and one pinned
+ * handle, frees every other handle and compacts. The heap must shrink,
+ * unpinned handles must have moved with their contents, and the fixed
+ * blocks must not have moved or changed.
+ */
+static bool check_compaction(void) {
+    heap_handle handles[COMPACT_HANDLES];
+    void *before[COMPACT_HANDLES];
+    void *fixed[COMPACT_HANDLES / 50];
+    int nfixed = 0;
+
+    for (int i = 0; i < COMPACT_HANDLES; i++) {
+        size_t size = 24 + 8 * (i % 13);
+        handles[i] = hmalloc(size);
+        if (handles[i] == 0) {
+            return false;
+        }
+        before[i] = hlock(handles[i]);
+        fill(before[i], size, i);
+        hunlock(handles[i]);
+        if (i % 50 == 0) {
+            fixed[nfixed] = mymalloc(40);
+            fill(fixed[nfixed], 40, 0xF0 + nfixed);
+            nfixed++;
+        }
+    }
+    int pinned = COMPACT_HANDLES / 2 + 1;
+    hlock(handles[pinned]);
+    for (int i = 0; i < COMPACT_HANDLES; i += 2) {
+        hfree(handles[i]);
+        handles[i] = 0;
+    }
+
+    if (heap_compact() == 0 || !validate_heap()) {
+        return false;
+    }
+
+    int nmoved = 0;
+    for (int i = 0; i < COMPACT_HANDLES; i++) {
+        if (handles[i] == 0) {
+            continue;
+        }
+        void *now = hlock(handles[i]);
+        nmoved += now != before[i];
+        bool kept = intact(now, 24 + 8 * (i % 13), i) && (i != pinned || now == before[i]);
+        hunlock(handles[i]);
+        if (!kept) {
+            return false;
+        }
+    }
+    for (int k = 0; k < nfixed; k++) {
+        if (!intact(fixed[k], 40, 0xF0 + k)) {
+            return false;
+        }
+    }
+    hunlock(handles[pinned]);
+    return nmoved > 0;
+}
+
+/* Function: check_persistence
+ * ---------------------------
+ * Runs the stages in turn on one heap file, each in a new process: create
+ * the heap and shut it down cleanly, reattach and exit without a shutdown
+ * as a crash would, then reattach twice more. Every stage verifies the
+ * blocks left by the previous ones, then frees, grows and allocates some.
+ */
+static bool check_persistence(void) {
+    char path[64], root[32];
+    snprintf(path, sizeof(path), "/tmp/heap_persist.%d", (int)getpid());
+    unlink(path);
+    bool passed = run_stage("create", path, NULL, root, sizeof(root)) &&
+        run_stage("crash", path, root, NULL, 0) &&
+        run_stage("reopen", path, root, NULL, 0) &&
+        run_stage("reopen", path, root, NULL, 0);
+    unlink(path);
+    return passed;
+}
+
+/* Function: run_stage
+ * -------------------
+ * Runs a stage of the persistence check in a new process, reading its
+ * output into output if given. Returns whether the stage passed.
+ */
+static bool run_stage(const char *stage, const char *path, const char *root, char *output,
+    size_t output_len) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        return false;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        execl(program_path, program_path, "-stage", stage, path, root, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    ssize_t nread = 0;
+    if (output != NULL) {
+        nread = read(fds[0], output, output_len - 1);
+        output[nread > 0 ? nread : 0] = '\0';
+    }
+    close(fds[0]);
+    int status;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0 && (output == NULL || nread > 0);
+}
+
+/* Function: persist_stage
+ * -----------------------
+ * One stage of the persistence check, in its own process. create makes a
+ * new heap and prints the address of its root block; the others reattach
+ * to the heap, whose root is given. All but crash shut the heap down
+ * before exiting. Returns the exit status, 0 if the stage passed.
+ */
+static int persist_stage(const char *stage, const char *path, const char *root_arg) {
+    bool create = strcmp(stage, "create") == 0;
+    if (init_heap_segment_file(path, PERSIST_HEAP_SIZE) == NULL ||
+        !myinit(heap_segment_start(), heap_segment_size()) ||
+        heap_was_reattached() == create || !validate_heap()) {
+        return 1;
+    }
+
+    // the root block lists the blocks of the check
+    test_blocks *root;
+    if (create) {
+        root = mymalloc(sizeof(test_blocks));
+        memset(root, 0, sizeof(test_blocks));
+        mutate_blocks(root, 0);
+    } else {
+        root = (test_blocks *)strtoul(root_arg, NULL, 16);
+        if (!verify_blocks(root)) {
+            return 1;
+        }
+        mutate_blocks(root, strcmp(stage, "crash") == 0 ? 1 : 2);
+    }
+    if (!verify_blocks(root) || !validate_heap()) {
+        return 1;
+    }
+
+    if (strcmp(stage, "crash") != 0) {
+        heap_shutdown();
+    }
+    if (!sync_heap_segment()) {
+        return 1;
+    }
+    if (create) {
+        printf("%lx\n", (unsigned long)root);
+    }
+    return 0;
+}
+
+/* Function: check_isolation
+ * -------------------------
+ * Allocates isolated blocks of every size up to a few lines among plain
+ * blocks, then frees and reallocates some of the plain ones so that new
+ * blocks are carved out of free space next to the isolated ones. Every
+ * isolated payload must start on a cache line, and no other payload may
+ * touch the lines it spans.
+ */
+static bool check_isolation(void) {
+    void *ptrs[ISOLATED_BLOCKS];
+    size_t sizes[ISOLATED_BLOCKS];
+    bool isolated[ISOLATED_BLOCKS];
+
+    for (int i = 0; i < ISOLATED_BLOCKS; i++) {
+        isolated[i] = i % 3 == 1;
+        sizes[i] = isolated[i] ? 1 + (i * 37) % (4 * CACHE_LINE_BYTES) : 8 + (i * 13) % 120;
+        ptrs[i] = isolated[i] ? mymalloc_isolated(sizes[i]) : mymalloc(sizes[i]);
+        if (ptrs[i] == NULL) {
+            return false;
+        }
+        fill(ptrs[i], sizes[i], i);
+    }
+    if (!lines_isolated(ptrs, sizes, isolated, ISOLATED_BLOCKS)) {
+        return false;
+    }
+
+    for (int i = 0; i < ISOLATED_BLOCKS; i += 3) {
+        myfree(ptrs[i]);
+        sizes[i] = 8 + (i * 29) % 200;
+        ptrs[i] = mymalloc(sizes[i]);
+        fill(ptrs[i], sizes[i], i);
+    }
+    for (int i = 2; i < ISOLATED_BLOCKS; i += 6) {
+        sizes[i] += 40;
+        ptrs[i] = myrealloc(ptrs[i], sizes[i]);
+        fill(ptrs[i], sizes[i], i);
+    }
+    if (!lines_isolated(ptrs, sizes, isolated, ISOLATED_BLOCKS)) {
+        return false;
+    }
+    for (int i = 0; i < ISOLATED_BLOCKS; i++) {
+        if (!intact(ptrs[i], sizes[i], i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function: lines_isolated
+ * ------------------------
+ * Returns whether each isolated payload starts on a cache line and no
+ * other payload overlaps the lines from its start to the end of its last.
+ */
+static bool lines_isolated(void **ptrs, size_t *sizes, bool *isolated, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!isolated[i]) {
+            continue;
+        }
+        uintptr_t start = (uintptr_t)ptrs[i];
+        uintptr_t end = (start + sizes[i] + CACHE_LINE_BYTES - 1) & ~(uintptr_t)(CACHE_LINE_BYTES - 1);
+        if (start % CACHE_LINE_BYTES != 0) {
+            return false;
+        }
+        for (int j = 0; j < count; j++) {
+            uintptr_t other = (uintptr_t)ptrs[j];
+            if (j != i && other < end && other + sizes[j] > start) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Function: check_realloc_full
+ * ----------------------------
+ * Grows a block with realloc on a small heap, allocating a blocker after
+ * each move so it cannot grow in place, until the heap runs out. The
+ * slack a repeatedly grown block is given may not fit when the request
+ * itself does: every block must lie within the heap and keep its
+ * contents, and a realloc that fails must leave the old block intact.
+ */
+static bool check_realloc_full(void) {
+    static const size_t GROWTH[] = {6000, 7000, 12000, 14000, 20000, 30000};
+    init_heap_segment(FULL_HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        return false;
+    }
+
+    size_t size = 5000;
+    char *block = mymalloc(size);
+    if (block == NULL) {
+        return false;
+    }
+    fill(block, size, 'b');
+    int ngrown = 0;
+    for (int i = 0; i < sizeof(GROWTH) / sizeof(GROWTH[0]); i++) {
+        char *grown = myrealloc(block, GROWTH[i]);
+        if (grown == NULL) {
+            break;
+        }
+        if (!within_heap(grown, GROWTH[i]) || !intact(grown, size, 'b')) {
+            return false;
+        }
+        block = grown;
+        size = GROWTH[i];
+        fill(block, size, 'b');
+        ngrown++;
+
+        char *blocker = mymalloc(100);
+        if (blocker != NULL) {
+            if (!within_heap(blocker, 100)) {
+                return false;
+            }
+            fill(blocker, 100, 'x');
+        }
+    }
+    return ngrown >= 3 && intact(block, size, 'b');
+}
+
+/* Function: check_restore_merge
+ * -----------------------------
+ * Frees a run of adjacent blocks below a kept one and snapshots the heap,
+ * then fills the whole run with one block and restores. A block as large
+ * again must come from the run, not from growing the heap, even where
+ * frees are merged only when the heap would grow (DEFERRED_COALESCING).
+ */
+static bool check_restore_merge(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/heap_merge_test.%d", (int)getpid());
+    void *run[MERGE_BLOCKS];
+    for (int i = 0; i < MERGE_BLOCKS; i++) {
+        run[i] = mymalloc(MERGE_BLOCK_SIZE);
+    }
+    void *kept = mymalloc(MERGE_BLOCK_SIZE);
+    fill(kept, MERGE_BLOCK_SIZE, 'k');
+    for (int i = 0; i < MERGE_BLOCKS; i++) {
+        myfree(run[i]);
+    }
+    // as large as the merged run, less at most a header, so none is left
+    size_t large = (char *)kept - (char *)run[0] - 16;
+    heap_stats before, after;
+    heap_get_stats(&before);
+    bool passed = heap_snapshot(path) && mymalloc(large) != NULL && heap_restore(path);
+    unlink(path);
+
+    void *merged = passed ? mymalloc(large) : NULL;
+    heap_get_stats(&after);
+    return merged != NULL && after.heap_bytes == before.heap_bytes &&
+        intact(kept, MERGE_BLOCK_SIZE, 'k');
+}
+
+/* Function: within_heap
+ * ---------------------
+ * Returns whether size bytes at ptr lie within the bytes of the segment
+ * the heap is using.
+ */
+static bool within_heap(const void *ptr, size_t size) {
+    heap_stats stats;
+    heap_get_stats(&stats);
+    const char *start = heap_segment_start();
+    return (const char *)ptr >= start && (const char *)ptr + size <= start + stats.heap_bytes;
+}
@@ -1,10 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#ifdef SIZE_INDEX
+#include <immintrin.h>
+#endif
 
 #include "allocator.h"
 #include "debug_break.h"
+#include "free_bitmap.h"
+#include "segment.h"
+#include "size_tuning.h"
 
 
 /**
@@ -15,6 +22,12 @@
 #define BLOCK_HEADER_BYTES              8
 #define MIN_PAYLOAD_BYTES               8
 
+/**
+ * Small helpers on the hot paths are internal to this file, and
+ * inlined whatever the optimization level
+ */
+#define INTERNAL_INLINE                 static inline __attribute__ ((always_inline))
+
 
 /**
  * Heap global variables
@@ -24,6 +37,39 @@ static size_t segment_size;     // heap size
 
 static size_t bytes_used;       // heap bytes
 
+static heap_stats stats;        // allocation counters
+
+
+/**
+ * SIZE_INDEX keeps a side array of block sizes in address order, 
+ * so that the free-block search scans contiguous memory rather than
+ * chasing headers, 8 entries at a time with AVX2 when the CPU has it.
+ * Entry i holds the payload bytes of the i-th block if it is free, or 
+ * 0 if used, and the block's offset from segment_start. Past the 
+ * capacity, or on segments over 4 GiB, the index is dropped and the 
+ * search walks the headers until the next myinit
+ */
+#ifdef SIZE_INDEX
+#define SIZE_INDEX_CAPACITY         65536
+
+static uint32_t index_sizes[SIZE_INDEX_CAPACITY];       // free payload bytes, 0 if used
+static uint32_t index_offsets[SIZE_INDEX_CAPACITY];     // from segment_start
+static size_t index_count;                              // entries, one per block
+static bool index_enabled;                              // entries match the heap
+static size_t (*index_best_fit) (uint32_t);             // scalar or AVX2 scan
+#endif
+
+
+/**
+ * FREE_BITMAP marks the free blocks for the header walk of the 
+ * free-block search. With SIZE_INDEX the walk only runs once the 
+ * index is dropped, so the bitmap is not kept up to date before: 
+ * the walk rebuilds it the first time, and updates keep it current
+ */
+#ifdef FREE_BITMAP
+static bool bitmap_current;     // marks match the heap
+#endif
+
 
 /**
  * Establishes if the a pointer is within another
@@ -34,7 +80,7 @@ static size_t bytes_used;       // heap bytes
  * 
  * Return: if first pointer is within bound set by the second
  */
-bool within_bounds (void* ptr1, void* ptr2){
+INTERNAL_INLINE bool within_bounds (void* ptr1, void* ptr2){
     return ptr1 < ptr2;
 }
 
@@ -52,11 +98,32 @@ bool within_bounds (void* ptr1, void* ptr2){
  *  the nearest multiple
  * 
  */
-size_t roundup (size_t sz, size_t mult) {
+INTERNAL_INLINE size_t roundup (size_t sz, size_t mult) {
     return (sz + mult - 1) & ~(mult - 1);
 }
 
 
+/**
+ * Computes the statistics size class of a payload size,
+ *  which is the position of its highest set bit
+ * 
+ * Argument
+ *  - size: payload bytes
+ * 
+ * Returns: index into the heap_stats per-class counters
+ */
+size_t stats_size_class (size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    size_t size_class = 63 - __builtin_clzl (size);
+    if (size_class >= HEAP_STATS_SIZE_CLASSES) {
+        return HEAP_STATS_SIZE_CLASSES - 1;
+    }
+    return size_class;
+}
+
+
 /**
  * Implicit heap allocation header 
  */
@@ -81,7 +148,7 @@ typedef struct {
  * Returns:
  *  pointer to the top of the header, shifted by the given offset
  */
-void* heap_top (size_t offset) {
+INTERNAL_INLINE void* heap_top (size_t offset) {
     void* top = (char*) segment_start + bytes_used + offset;
     assert (top != NULL);
     return top;
@@ -96,7 +163,7 @@ void* heap_top (size_t offset) {
  * 
  * Returns: size from the header's encoding
  */
-size_t header_payload_size (heap_header header) {
+INTERNAL_INLINE size_t header_payload_size (heap_header header) {
     return (size_t) (header.encoding & ~BLOCK_SIZE_MASK);
 }
 
@@ -109,7 +176,7 @@ size_t header_payload_size (heap_header header) {
  * 
  * Returns: wether the block is used or not
  */
-bool header_block_is_used (heap_header header) {
+INTERNAL_INLINE bool header_block_is_used (heap_header header) {
     return (bool) (header.encoding & BLOCK_USED_MASK);
 } 
 
@@ -123,7 +190,7 @@ bool header_block_is_used (heap_header header) {
  * 
  * Returns: header with encoded size and usage
  */
-heap_header header_factory (size_t requested_size, bool is_used) {
+INTERNAL_INLINE heap_header header_factory (size_t requested_size, bool is_used) {
     
     heap_header header;
     header.encoding = requested_size;
@@ -146,7 +213,7 @@ heap_header header_factory (size_t requested_size, bool is_used) {
  * 
  * Returns: pointer to the payload
  */
-void* get_block_payload_from_header (heap_header* header_ptr) {
+INTERNAL_INLINE void* get_block_payload_from_header (heap_header* header_ptr) {
     return (char*) header_ptr + BLOCK_HEADER_BYTES;
 }
 
@@ -159,7 +226,7 @@ void* get_block_payload_from_header (heap_header* header_ptr) {
  * 
  * Returns: pointer to the header in the same heap block
  */
-heap_header* get_block_pointer_from_payload (void* payload_ptr) {
+INTERNAL_INLINE heap_header* get_block_pointer_from_payload (void* payload_ptr) {
     return (heap_header*) ((char*) payload_ptr - BLOCK_HEADER_BYTES);
 }
 
@@ -173,7 +240,7 @@ heap_header* get_block_pointer_from_payload (void* payload_ptr) {
  * 
  * Returns: the location of the next header
  */
-heap_header* get_next_implicit_header (heap_header header_object, 
+INTERNAL_INLINE heap_header* get_next_implicit_header (heap_header header_object, 
                                        heap_header* header_ptr) {
     size_t size = header_payload_size (header_object);
     void* next_header = (char*) get_block_payload_from_header (header_ptr) + size;
@@ -191,7 +258,7 @@ heap_header* get_next_implicit_header (heap_header header_object,
  * Returns: poiiniter to the nextheader
  * 
  */
-heap_header* get_next_block_header (heap_header* header_ptr, 
+INTERNAL_INLINE heap_header* get_next_block_header (heap_header* header_ptr, 
                                     size_t block_bytes) {
     heap_header* next_ptr = (heap_header*) ((char*) header_ptr + block_bytes);
     return next_ptr;
@@ -205,7 +272,7 @@ heap_header* get_next_block_header (heap_header* header_ptr,
  *  - header_ptr: location
  *  - header: to write
  */
-void write_header (void* header_ptr, heap_header* header) {
+INTERNAL_INLINE void write_header (void* header_ptr, heap_header* header) {
     void* result = memcpy (header_ptr, header, BLOCK_HEADER_BYTES);
     assert (result != NULL); 
 }
@@ -219,7 +286,7 @@ void write_header (void* header_ptr, heap_header* header) {
  * 
  * Returns: header 
  */
-void read_header (heap_header* header_object, void *header_ptr) {
+INTERNAL_INLINE void read_header (heap_header* header_object, void *header_ptr) {
     void* result = memcpy (header_object, header_ptr, BLOCK_HEADER_BYTES); 
     assert (result != NULL);
 }
@@ -234,7 +301,7 @@ void read_header (heap_header* header_object, void *header_ptr) {
  * 
  * Returns: size from the header's encoding
  */
-size_t block_payload_size (heap_header* header_ptr) {
+INTERNAL_INLINE size_t block_payload_size (heap_header* header_ptr) {
     heap_header header;
     read_header (&header, header_ptr);
     size_t size = header_payload_size (header);    
@@ -242,6 +309,298 @@ size_t block_payload_size (heap_header* header_ptr) {
 }
 
 
+/**
+ * First block for the free-block search: the bottom of the heap,
+ *  or with FREE_BITMAP the first free block, heap_end if none
+ * 
+ * Argument
+ *  - heap_end: top of the heap
+ * 
+ * Returns: pointer to the header
+ */
+heap_header* first_search_header (heap_header* heap_end) {
+#ifdef FREE_BITMAP
+    heap_header* first = free_bitmap_next (segment_start, heap_end);
+    return first == NULL ? heap_end : first;
+#else
+    return (heap_header*) segment_start;
+#endif
+}
+
+
+/**
+ * Next block for the free-block search: the next block in the heap,
+ *  or with FREE_BITMAP the next free block, heap_end if none
+ * 
+ * Argument
+ *  - header: the current header
+ *  - header_ptr: its location
+ *  - heap_end: top of the heap
+ * 
+ * Returns: pointer to the header
+ */
+heap_header* next_search_header (heap_header header, heap_header* header_ptr,
+                                 heap_header* heap_end) {
+#ifdef FREE_BITMAP
+    heap_header* next = free_bitmap_next ((char*) header_ptr + 1, heap_end);
+    return next == NULL ? heap_end : next;
+#else
+    return get_next_implicit_header (header, header_ptr);
+#endif
+}
+
+
+#ifdef FREE_BITMAP
+/**
+ * Marks every free block in the bitmap, by a walk of the heap
+ * 
+ * Returns: n/a
+ */
+void rebuild_free_bitmap () {
+
+    free_bitmap_reset ();
+    bitmap_current = true;
+
+    heap_header* ptr = segment_start;
+    heap_header* heap_end = heap_top (0);
+    heap_header header;
+
+    while (within_bounds (ptr, heap_end)) {
+        read_header (&header, ptr);
+        if (!header_block_is_used (header)) {
+            free_bitmap_mark (ptr);
+        }
+        ptr = get_next_implicit_header (header, ptr);
+    }
+}
+
+
+/**
+ * Checks that the bitmap marks exactly the free blocks, by a walk
+ *  of the heap
+ * 
+ * Returns: true/false on the bitmap matching
+ */
+bool valid_free_bitmap () {
+
+    heap_header* ptr = segment_start;
+    heap_header* heap_end = heap_top (0);
+    heap_header header;
+    void* marked = free_bitmap_next (ptr, heap_end);
+
+    while (within_bounds (ptr, heap_end)) {
+        read_header (&header, ptr);
+        if (!header_block_is_used (header)) {
+            if (marked != ptr) {
+                return false;
+            }
+            marked = free_bitmap_next ((char*) ptr + 1, heap_end);
+        }
+        ptr = get_next_implicit_header (header, ptr);
+    }
+    return marked == NULL;
+}
+#endif
+
+
+#ifdef SIZE_INDEX
+/**
+ * Best fit by a scan of the size index: the first entry of the
+ *  smallest free size of at least the payload requested
+ * 
+ * Argument
+ *  - payload_bytes: padded payload requested
+ * 
+ * Returns: position of the entry, index_count if none fits
+ */
+size_t size_index_best_fit_scalar (uint32_t payload_bytes) {
+
+    size_t found = index_count;
+    uint32_t best_size = UINT32_MAX;
+
+    for (size_t position = 0; position < index_count; position++) {
+        uint32_t size = index_sizes[position];
+        if (size >= payload_bytes && size < best_size) {
+            found = position;
+            best_size = size;
+            if (size == payload_bytes) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+
+/**
+ * Best fit as size_index_best_fit_scalar, 8 entries at a time.
+ *  Stops at the first exact fit; otherwise a second pass finds
+ *  the first entry of the smallest fitting size
+ * 
+ * Argument
+ *  - payload_bytes: padded payload requested
+ * 
+ * Returns: position of the entry, index_count if none fits
+ */
+__attribute__ ((target ("avx2")))
+size_t size_index_best_fit_avx2 (uint32_t payload_bytes) {
+
+    __m256i wanted = _mm256_set1_epi32 ((int) payload_bytes);
+    __m256i best = _mm256_set1_epi32 (-1);
+    size_t position = 0;
+
+    for (; position + 8 <= index_count; position += 8) {
+        __m256i sizes = _mm256_loadu_si256 ((__m256i*) &index_sizes[position]);
+        unsigned exact = _mm256_movemask_ps (_mm256_castsi256_ps (_mm256_cmpeq_epi32 (sizes, wanted)));
+        if (exact) {
+            return position + __builtin_ctz (exact);
+        }
+        // sizes too small become UINT32_MAX before the running minimum
+        __m256i fits = _mm256_cmpeq_epi32 (_mm256_max_epu32 (sizes, wanted), sizes);
+        best = _mm256_min_epu32 (best, _mm256_or_si256 (sizes, _mm256_andnot_si256 (fits, _mm256_set1_epi32 (-1))));
+    }
+
+    uint32_t lanes[8];
+    _mm256_storeu_si256 ((__m256i*) lanes, best);
+    uint32_t best_size = UINT32_MAX;
+    for (size_t lane = 0; lane < 8; lane++) {
+        if (lanes[lane] < best_size) {
+            best_size = lanes[lane];
+        }
+    }
+    for (size_t tail = position; tail < index_count; tail++) {
+        uint32_t size = index_sizes[tail];
+        if (size >= payload_bytes && size < best_size) {
+            best_size = size;
+        }
+    }
+    if (best_size == UINT32_MAX) {
+        return index_count;
+    }
+
+    // first entry of that size
+    __m256i target = _mm256_set1_epi32 ((int) best_size);
+    for (position = 0; position + 8 <= index_count; position += 8) {
+        __m256i sizes = _mm256_loadu_si256 ((__m256i*) &index_sizes[position]);
+        unsigned match = _mm256_movemask_ps (_mm256_castsi256_ps (_mm256_cmpeq_epi32 (sizes, target)));
+        if (match) {
+            return position + __builtin_ctz (match);
+        }
+    }
+    while (index_sizes[position] != best_size) {
+        position++;
+    }
+    return position;
+}
+
+
+/**
+ * Position of a block in the size index, by binary search
+ *  of the offsets
+ * 
+ * Argument
+ *  - header_ptr: block in the index
+ * 
+ * Returns: its position
+ */
+size_t size_index_position (heap_header* header_ptr) {
+
+    uint32_t offset = (uint32_t) ((char*) header_ptr - (char*) segment_start);
+    size_t low = 0;
+    size_t high = index_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index_offsets[middle] < offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    assert (low < index_count && index_offsets[low] == offset);
+    return low;
+}
+
+
+/**
+ * Inserts an entry into the size index, dropping the index 
+ *  if it is full
+ * 
+ * Argument
+ *  - position: where the entry goes
+ *  - header_ptr: its block
+ *  - free_bytes: payload bytes if free, 0 if used
+ * 
+ * Returns: n/a
+ */
+void size_index_insert (size_t position, heap_header* header_ptr, size_t free_bytes) {
+
+    if (index_count == SIZE_INDEX_CAPACITY) {
+        index_enabled = false;
+        return;
+    }
+    size_t moved = index_count - position;
+    memmove (&index_sizes[position + 1], &index_sizes[position], moved * sizeof (uint32_t));
+    memmove (&index_offsets[position + 1], &index_offsets[position], moved * sizeof (uint32_t));
+    index_sizes[position] = (uint32_t) free_bytes;
+    index_offsets[position] = (uint32_t) ((char*) header_ptr - (char*) segment_start);
+    index_count++;
+}
+
+
+/**
+ * Rebuilds the size index by a walk of the heap
+ * 
+ * Returns: n/a
+ */
+void size_index_rebuild () {
+
+    index_count = 0;
+    index_enabled = segment_size <= (1UL << 32);
+
+    heap_header* ptr = segment_start;
+    heap_header* heap_end = heap_top (0);
+    heap_header header;
+
+    while (index_enabled && within_bounds (ptr, heap_end)) {
+        read_header (&header, ptr);
+        size_t size = header_block_is_used (header) ? 0 : header_payload_size (header);
+        size_index_insert (index_count, ptr, size);
+        ptr = get_next_implicit_header (header, ptr);
+    }
+}
+
+
+/**
+ * Checks the size index against a walk of the heap
+ * 
+ * Returns: true/false on the index matching
+ */
+bool valid_size_index () {
+
+    if (!index_enabled) {
+        return true;
+    }
+
+    heap_header* ptr = segment_start;
+    heap_header* heap_end = heap_top (0);
+    heap_header header;
+    size_t position = 0;
+
+    while (within_bounds (ptr, heap_end)) {
+        read_header (&header, ptr);
+        size_t size = header_block_is_used (header) ? 0 : header_payload_size (header);
+        if (position == index_count || index_sizes[position] != size ||
+            index_offsets[position] != (uint32_t) ((char*) ptr - (char*) segment_start)) {
+            return false;
+        }
+        position++;
+        ptr = get_next_implicit_header (header, ptr);
+    }
+    return position == index_count;
+}
+#endif
+
+
 /**
  * Reset the heap allocator to an empty initial state
  * 
@@ -255,6 +614,7 @@ bool myinit (void *heap_start, size_t heap_size) {
 
     // stats
     bytes_used = 0;
+    memset (&stats, 0, sizeof (stats));
 
     // exception
     if (heap_size == 0) {
@@ -271,6 +631,24 @@ bool myinit (void *heap_start, size_t heap_size) {
     
     // init
     segment_start = heap_start;
+#ifndef TUNED_SPLIT_BYTES
+    size_tuning_reset (MIN_PAYLOAD_BYTES, 0);
+#endif
+#ifdef FREE_BITMAP
+    if (!free_bitmap_init (segment_start, segment_size)) {
+        return false;
+    }
+#endif
+#ifdef SIZE_INDEX
+    index_best_fit = __builtin_cpu_supports ("avx2") ? 
+        size_index_best_fit_avx2 : size_index_best_fit_scalar;
+    size_index_rebuild ();
+#endif
+#if defined (FREE_BITMAP) && defined (SIZE_INDEX)
+    bitmap_current = !index_enabled;
+#elif defined (FREE_BITMAP)
+    bitmap_current = true;
+#endif
     
     return true;
 }
@@ -279,12 +657,28 @@ bool myinit (void *heap_start, size_t heap_size) {
 /**
  * Returns the size of the smallest possible block
  */
-size_t min_block_size (){
+INTERNAL_INLINE size_t min_block_size (){
     // header plus minimal payload
     return BLOCK_HEADER_BYTES + MIN_PAYLOAD_BYTES;
 }
 
 
+/**
+ * Returns the size of the smallest block worth splitting off a free 
+ *  block: one that fits a small request, as tuned to request sizes
+ *  unless compiled in
+ */
+size_t min_split_block_size () {
+#ifdef TUNED_SPLIT_BYTES
+    size_t split_bytes = TUNED_SPLIT_BYTES;
+#else
+    size_t split_bytes = size_tuning_split_bytes ();
+#endif
+    return BLOCK_HEADER_BYTES + 
+           (split_bytes > MIN_PAYLOAD_BYTES ? split_bytes : MIN_PAYLOAD_BYTES);
+}
+
+
 /**
  * Returns the size of the smallest block to fit a request
  */ 
@@ -348,9 +742,24 @@ heap_header* find_free_block (size_t requested_size) {
     // heap
     size_t padded_block_bytes = valid_alloc (requested_size);
     size_t padded_payload_bytes = request_payload (padded_block_bytes);
+
+#ifdef SIZE_INDEX
+    if (index_enabled) {
+        size_t position = index_best_fit ((uint32_t) padded_payload_bytes);
+        if (position == index_count) {
+            return NULL;
+        }
+        return (heap_header*) ((char*) segment_start + index_offsets[position]);
+    }
+#endif
+#ifdef FREE_BITMAP
+    if (!bitmap_current) {
+        rebuild_free_bitmap ();
+    }
+#endif
     
-    heap_header* curr_header_ptr = (heap_header*) segment_start; 
     heap_header* heap_end = heap_top (0);
+    heap_header* curr_header_ptr = first_search_header (heap_end);
 
     // header
     heap_header header;
@@ -374,7 +783,7 @@ heap_header* find_free_block (size_t requested_size) {
         } 
         
         // next
-        curr_header_ptr = get_next_implicit_header (header, curr_header_ptr);
+        curr_header_ptr = next_search_header (header, curr_header_ptr, heap_end);
     }
     
     return found_fit;
@@ -424,7 +833,18 @@ void myfree (void *payload_ptr) {
     
     heap_header* header_ptr = get_block_pointer_from_payload (payload_ptr);
     size_t block_bytes = block_payload_size (header_ptr);
+    stats.free_count[stats_size_class (block_bytes)]++;
     free_heap_block (header_ptr, block_bytes);
+#ifdef FREE_BITMAP
+    if (bitmap_current) {
+        free_bitmap_mark (header_ptr);
+    }
+#endif
+#ifdef SIZE_INDEX
+    if (index_enabled) {
+        index_sizes[size_index_position (header_ptr)] = (uint32_t) block_bytes;
+    }
+#endif
 }
 
 
@@ -446,9 +866,20 @@ void alloc_free_block (heap_header* insert_ptr,
                        size_t padded_block_bytes, size_t padded_payload_bytes) {
 
     size_t free_size = block_payload_size (insert_ptr);
+#ifdef FREE_BITMAP
+    if (bitmap_current) {
+        free_bitmap_unmark (insert_ptr);
+    }
+#endif
+#ifdef SIZE_INDEX
+    size_t position = index_enabled ? size_index_position (insert_ptr) : 0;
+    if (index_enabled) {
+        index_sizes[position] = 0;
+    }
+#endif
         
     // is there enough space to justify a split?
-    if (free_size >= padded_block_bytes + min_block_size()) {
+    if (free_size >= padded_block_bytes + min_split_block_size ()) {
         // partition: used 
         heap_header header_insert = header_factory (padded_payload_bytes, true);
         write_header (insert_ptr, &header_insert);
@@ -457,6 +888,17 @@ void alloc_free_block (heap_header* insert_ptr,
                                                         padded_block_bytes);
         size_t split_size = free_size - padded_block_bytes;
         free_heap_block (split_ptr, split_size);
+        stats.split_count++;
+#ifdef FREE_BITMAP
+        if (bitmap_current) {
+            free_bitmap_mark (split_ptr);
+        }
+#endif
+#ifdef SIZE_INDEX
+        if (index_enabled) {
+            size_index_insert (position + 1, split_ptr, split_size);
+        }
+#endif
 
     } else {
         // main
@@ -476,6 +918,11 @@ void alloc_free_block (heap_header* insert_ptr,
 void alloc_new_block (heap_header* insert_ptr, size_t padded_payload_bytes) {
     heap_header header_insert = header_factory (padded_payload_bytes, true);    
     write_header (insert_ptr, &header_insert);    
+#ifdef SIZE_INDEX
+    if (index_enabled) {
+        size_index_insert (index_count, insert_ptr, 0);
+    }
+#endif
 }
 
 
@@ -491,6 +938,9 @@ void* mymalloc (size_t requested_size) {
     if (!requested_size) {
         return NULL;
     }
+#ifndef TUNED_SPLIT_BYTES
+    size_tuning_record (requested_size);
+#endif
     
     // scope
     size_t padded_block_bytes = valid_alloc (requested_size);
@@ -518,6 +968,7 @@ void* mymalloc (size_t requested_size) {
     if (!is_reuse) {
         bytes_used += padded_block_bytes;
     }
+    stats.alloc_count[stats_size_class (padded_payload_bytes)]++;
 
     return payload_ptr;
 }
@@ -533,6 +984,9 @@ void* mymalloc (size_t requested_size) {
  */
 void* myrealloc (void *old_ptr, size_t requested_size) {
 
+    // implicit never reallocates in place
+    stats.realloc_inplace_misses++;
+
     // allocate
     void* new_ptr = mymalloc (requested_size);
     assert (new_ptr != NULL);
@@ -544,6 +998,7 @@ void* myrealloc (void *old_ptr, size_t requested_size) {
     // copy
     size_t size = requested_size > old_size? old_size : requested_size; 
     memcpy (new_ptr, old_ptr, size);
+    stats.realloc_copy_bytes += size;
     // free
     myfree (old_ptr);
     
@@ -622,6 +1077,98 @@ bool valid_implicit_heap  () {
 }
 
 
+/**
+ * Reports allocator statistics, walking every block for the byte
+ * and free block figures, and copying the running counters
+ * 
+ * Argument
+ *  - out: statistics to fill in
+ * 
+ * Returns: n/a
+ */
+void heap_get_stats (heap_stats* out) {
+
+    *out = stats;
+    out->heap_bytes = bytes_used;
+
+    // heap
+    heap_header* ptr = segment_start; 
+    heap_header* heap_end = heap_top (0);
+
+    // header
+    heap_header header;
+
+    while (within_bounds (ptr, heap_end)) {
+        // current
+        read_header (&header, ptr);
+        size_t size = header_payload_size (header);
+        if (header_block_is_used (header)) {
+            out->live_bytes += size;
+        } else {
+            out->free_bytes += size;
+            out->free_blocks += 1;
+            if (size > out->largest_free_block) {
+                out->largest_free_block = size;
+            }
+        }
+        // next
+        ptr = get_next_implicit_header (header, ptr);
+    }
+}
+
+
+/**
+ * Heap globals saved by heap_snapshot
+ */
+typedef struct {
+    size_t bytes_used;
+    heap_stats stats;
+} heap_state;
+
+
+/**
+ * Writes the heap in use and its globals to a snapshot file
+ * 
+ * Argument
+ *  - path: snapshot file
+ * 
+ * Returns: true/false on success
+ */
+bool heap_snapshot (const char* path) {
+    heap_state state = {.bytes_used = bytes_used, .stats = stats};
+    return write_heap_snapshot (path, segment_start, segment_size, bytes_used, &state, sizeof (state));
+}
+
+
+/**
+ * Maps a snapshot file over the heap and restores its globals
+ * 
+ * Argument
+ *  - path: snapshot file
+ * 
+ * Returns: true/false on success
+ */
+bool heap_restore (const char* path) {
+    heap_state state;
+    size_t state_bytes = sizeof (state);
+    if (!map_heap_snapshot (path, segment_start, segment_size, &state, &state_bytes) ||
+        state_bytes != sizeof (state)) {
+        return false;
+    }
+    bytes_used = state.bytes_used;
+    stats = state.stats;
+#ifdef SIZE_INDEX
+    size_index_rebuild ();
+#endif
+#if defined (FREE_BITMAP) && defined (SIZE_INDEX)
+    bitmap_current = false;
+#elif defined (FREE_BITMAP)
+    rebuild_free_bitmap ();
+#endif
+    return true;
+}
+
+
 /**
  * Asserts the validity of the heap state
  * 
@@ -652,6 +1199,22 @@ bool validate_heap () {
         breakpoint();   
         return false;        
     }
+
+#ifdef FREE_BITMAP
+    if (bitmap_current && !valid_free_bitmap ()) {
+        printf ("\n Oops! Free bitmap does not match the heap!\n");
+        breakpoint();   
+        return false;        
+    }
+#endif
+
+#ifdef SIZE_INDEX
+    if (!valid_size_index ()) {
+        printf ("\n Oops! Size index does not match the heap!\n");
+        breakpoint();   
+        return false;        
+    }
+#endif
     
     return true;
 }
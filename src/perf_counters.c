@@ -0,0 +1,122 @@
+/* File: perf_counters.c
+ * ---------------------
+ * perf_event_open counter group, see perf_counters.h. Counting is limited
+ * to user space, so the ioctls that start and stop the group add almost
+ * nothing to the measurement.
+ */
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_counters.h"
+
+// type and config for each perf_event_index
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} events[PERF_NUM_EVENTS] = {
+    [PERF_INSTRUCTIONS] = {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERF_CYCLES] = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERF_L1D_MISSES] = {"L1d-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    [PERF_LLC_MISSES] = {"LLC-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [PERF_BRANCH_MISSES] = {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [PERF_DTLB_MISSES] = {"dTLB-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+/* Function: open_event
+ * --------------------
+ * Opens one counter of the calling thread, in group_fd's group (or as a
+ * new group leader if group_fd is -1). Returns the fd, or -1.
+ */
+static int open_event(int event, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.disabled = (group_fd == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+bool perf_counters_open(perf_counters *counters) {
+    memset(counters, 0, sizeof(*counters));
+    counters->leader_fd = -1;
+    for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+        counters->fds[i] = open_event(i, counters->leader_fd);
+        if (counters->fds[i] == -1) {
+            continue;
+        }
+        if (counters->leader_fd == -1) {
+            counters->leader_fd = counters->fds[i];
+        }
+        ioctl(counters->fds[i], PERF_EVENT_IOC_ID, &counters->ids[i]);
+    }
+    return counters->leader_fd != -1;
+}
+
+void perf_counters_close(perf_counters *counters) {
+    for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+        if (counters->fds[i] != -1) {
+            close(counters->fds[i]);
+            counters->fds[i] = -1;
+        }
+    }
+    counters->leader_fd = -1;
+}
+
+void perf_counters_start(perf_counters *counters) {
+    ioctl(counters->leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters_stop(perf_counters *counters, perf_totals *totals) {
+    ioctl(counters->leader_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // group read: nr, time enabled, time running, then {value, id} per event
+    uint64_t buffer[3 + 2 * PERF_NUM_EVENTS];
+    if (read(counters->leader_fd, buffer, sizeof(buffer)) <= 0) {
+        return;
+    }
+    totals->calls++;
+    totals->time_enabled += buffer[1] - counters->last_enabled;
+    totals->time_running += buffer[2] - counters->last_running;
+    counters->last_enabled = buffer[1];
+    counters->last_running = buffer[2];
+    for (uint64_t n = 0; n < buffer[0]; n++) {
+        uint64_t value = buffer[3 + 2 * n], id = buffer[4 + 2 * n];
+        for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+            if (counters->fds[i] != -1 && counters->ids[i] == id) {
+                totals->values[i] += value - counters->last[i];
+                counters->last[i] = value;
+            }
+        }
+    }
+}
+
+bool perf_counters_available(perf_counters *counters, enum perf_event_index event) {
+    return counters->fds[event] != -1;
+}
+
+bool perf_totals_value(const perf_totals *totals, enum perf_event_index event, double *value) {
+    if (totals->time_running == 0) {
+        *value = 0;
+        return totals->time_enabled == 0;
+    }
+    *value = (double)totals->values[event];
+    if (totals->time_running < totals->time_enabled) {
+        *value *= (double)totals->time_enabled / totals->time_running;
+    }
+    return true;
+}
+
+const char *perf_event_name(enum perf_event_index event) {
+    return events[event].name;
+}
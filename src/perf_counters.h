@@ -0,0 +1,96 @@
+/* File: perf_counters.h
+ * ---------------------
+ * Hardware performance counters read in-process through perf_event_open,
+ * for native measurements of allocator calls. The counters form one group
+ * that only runs between perf_counters_start and perf_counters_stop, and
+ * each stop adds what was counted to a perf_totals. Events the CPU or the
+ * kernel does not provide (e.g. in a VM or with a strict
+ * perf_event_paranoid setting) are reported as unavailable. When the
+ * kernel multiplexes the group with others, it runs for only part of the
+ * time it is enabled; the counts are scaled up to the time enabled, and a
+ * group that never ran has no counts to report.
+ */
+
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+#include <stdbool.h> // for bool
+#include <stdint.h>  // for uint64_t
+
+
+enum perf_event_index {
+    PERF_INSTRUCTIONS,
+    PERF_CYCLES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_NUM_EVENTS
+};
+
+// open counter group for the calling thread
+typedef struct {
+    int leader_fd;                          // -1 if no event could be opened
+    int fds[PERF_NUM_EVENTS];               // -1 for unavailable events
+    uint64_t ids[PERF_NUM_EVENTS];          // kernel ids, to match group reads
+    uint64_t last[PERF_NUM_EVENTS];         // values at the previous stop
+    uint64_t last_enabled;                  // times at the previous stop, in ns
+    uint64_t last_running;
+} perf_counters;
+
+// counts accumulated over a number of measured calls
+typedef struct {
+    unsigned long calls;
+    uint64_t values[PERF_NUM_EVENTS];       // raw counts, see perf_totals_value
+    uint64_t time_enabled;                  // ns the group was enabled
+    uint64_t time_running;                  // ns of those it was counting
+} perf_totals;
+
+
+/* Function: perf_counters_open
+ * ----------------------------
+ * Opens the counter group, disabled, for the calling thread. Returns false
+ * (with errno from the leader) if no event is available.
+ */
+bool perf_counters_open(perf_counters *counters);
+
+
+/* Function: perf_counters_close
+ * -----------------------------
+ * Closes every counter of the group.
+ */
+void perf_counters_close(perf_counters *counters);
+
+
+/* Functions: perf_counters_start, perf_counters_stop
+ * --------------------------------------------------
+ * Start lets the group count; stop freezes it and adds the counts since
+ * start to totals.
+ */
+void perf_counters_start(perf_counters *counters);
+void perf_counters_stop(perf_counters *counters, perf_totals *totals);
+
+
+/* Function: perf_counters_available
+ * ---------------------------------
+ * Returns whether the given event is being counted.
+ */
+bool perf_counters_available(perf_counters *counters, enum perf_event_index event);
+
+
+/* Function: perf_totals_value
+ * ---------------------------
+ * Sets *value to the total count of the given event, scaled up to the
+ * time enabled if the group was multiplexed. Returns false if the group
+ * was enabled but never ran, so nothing was measured.
+ */
+bool perf_totals_value(const perf_totals *totals, enum perf_event_index event, double *value);
+
+
+/* Function: perf_event_name
+ * -------------------------
+ * Returns a short column name for the given event.
+ */
+const char *perf_event_name(enum perf_event_index event);
+
+
+#endif
@@ -0,0 +1,37 @@
+/* File: persist.h
+ * ---------------
+ * Persistence interface for the explicit allocator. The heap keeps a
+ * superblock at the end of its segment with what it needs to reattach:
+ * heap size, free list ends and a clean-shutdown flag. On a file-backed
+ * segment (see init_heap_segment_file), the first myinit of a process finds
+ * the superblock left by the previous one and reattaches to its heap
+ * instead of emptying it; later calls to myinit reset the heap as usual.
+ *
+ * After a clean shutdown, reattaching restores the saved state and
+ * validates the heap. Otherwise the free list is rebuilt by walking the
+ * heap first, and myinit fails if the heap does not validate. Handles
+ * (handle.h) do not persist; their blocks stay allocated.
+ */
+
+#ifndef _PERSIST_H_
+#define _PERSIST_H_
+#include <stdbool.h> // for bool
+
+
+/* Function: heap_shutdown
+ * -----------------------
+ * Saves the heap state in the superblock and marks it cleanly shut down;
+ * call sync_heap_segment afterwards to write it to the file. The heap may
+ * still be used, which marks it in use again.
+ */
+void heap_shutdown(void);
+
+
+/* Function: heap_was_reattached
+ * -----------------------------
+ * Returns whether the last myinit reattached to an existing heap.
+ */
+bool heap_was_reattached(void);
+
+
+#endif
@@ -0,0 +1,28 @@
+/* File: placement.h
+ * -----------------
+ * Cache-line placement for the explicit allocator. Built with
+ * CACHE_LINE_PLACEMENT, mymalloc moves a small block past the next cache
+ * line boundary when its payload would otherwise straddle two lines and
+ * the bytes skipped, which become a free block, are few. mymalloc_isolated
+ * is for objects written by several threads: the payload starts on a line
+ * and fills whole lines, so no other block's payload shares them.
+ */
+
+#ifndef _PLACEMENT_H_
+#define _PLACEMENT_H_
+#include <stddef.h>  // for size_t
+
+// cache line size of the machines we target
+#define CACHE_LINE_BYTES 64
+
+
+/* Function: mymalloc_isolated
+ * ---------------------------
+ * Like mymalloc, but the block is aligned to and padded out to whole cache
+ * lines. Free and reallocate it as any other block; a reallocated block is
+ * no longer isolated.
+ */
+void *mymalloc_isolated(size_t size);
+
+
+#endif
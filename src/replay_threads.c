@@ -0,0 +1,440 @@
+/*
+ * File: replay_threads.c
+ * ----------------------
+ * Replays allocator scripts concurrently on several threads against one
+ * shared heap, to measure throughput and latency under contention.
+ *
+ *      replay_explicit [-t N] [-x] script...
+ *
+ * Given several scripts, each is replayed on its own thread. Given a single
+ * script, it is split by id range across N threads (-t, default 4), each
+ * replaying the requests of its own ids in script order. With -x, blocks
+ * are freed by the neighbouring thread instead of their owner: the owner
+ * verifies the payload and hands the pointer over through the neighbour's
+ * mailbox, which frees it on its next request.
+ *
+ * The allocators keep their state in globals, so calls are serialized
+ * through a single mutex; the time spent waiting for it is part of the
+ * measured latency. Each thread keeps its own block table and checks that
+ * payloads survive the other threads' requests.
+ */
+
+#include <error.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocator.h"
+#include "script.h"
+#include "segment.h"
+
+
+/* TYPE DECLARATIONS */
+
+
+// number of log2 latency buckets, bucket i counts [2^i, 2^(i+1)) ns
+#define LATENCY_BUCKETS 40
+
+// blocks handed to a thread to free on behalf of another
+typedef struct {
+    pthread_mutex_t lock;
+    void **ptrs;
+    int count;
+    int capacity;
+} mailbox_t;
+
+// state of one replay thread
+typedef struct {
+    int index;
+    script_t *script;           // script to replay (shared when split)
+    int first_id;               // ids this thread replays: [first_id, end_id)
+    int end_id;
+    block_t *blocks;            // this thread's block table, indexed by id
+    mailbox_t mailbox;          // blocks this thread must free
+    mailbox_t *free_to;         // mailbox of the thread that frees our blocks
+    pthread_t thread;
+
+    // results
+    bool failed;
+    int num_ops;
+    double seconds;
+    unsigned long latency[LATENCY_BUCKETS];
+} replay_t;
+
+
+/* CONSTANTS */
+
+
+const long HEAP_SIZE = 1L << 32;
+
+const int DEFAULT_THREADS = 4;
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static void *replay_main(void *arg);
+static bool replay_request(replay_t *replay, request_t *request);
+static void drain_mailbox(replay_t *replay);
+static void post_mailbox(mailbox_t *mailbox, void *ptr);
+static bool check_payload(replay_t *replay, void *ptr, size_t size, int id, const char *op);
+static void record_latency(replay_t *replay, struct timespec *start);
+static double elapsed_seconds(struct timespec *start, struct timespec *end);
+static unsigned long latency_percentile(replay_t *replay, double fraction);
+static void print_report(replay_t *replays, int nthreads, double wall_seconds);
+
+
+/* Lock serializing calls into the allocator */
+static pthread_mutex_t allocator_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Function: main
+ * --------------
+ * Parses the command line, sets up one replay per thread over a single
+ * shared heap, runs them and prints throughput and latency. Returns the
+ * number of threads that detected an error.
+ */
+int main(int argc, char *argv[]) {
+    int c;
+    int nthreads = DEFAULT_THREADS;
+    bool cross_free = false;
+    while ((c = getopt(argc, argv, "t:x")) != EOF) {
+        if (c == 't') {
+            nthreads = atoi(optarg);
+            if (nthreads <= 0) {
+                error(1, 0, "Thread count must be positive.");
+            }
+        } else if (c == 'x') {
+            cross_free = true;
+        }
+    }
+    int num_scripts = argc - optind;
+    if (num_scripts <= 0) {
+        error(1, 0, "Missing argument. Please supply one or more script files.");
+    }
+    if (num_scripts > 1) {
+        nthreads = num_scripts;
+    }
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    script_t *scripts = calloc(num_scripts, sizeof(script_t));
+    replay_t *replays = calloc(nthreads, sizeof(replay_t));
+    if (scripts == NULL || replays == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+    for (int i = 0; i < num_scripts; i++) {
+        scripts[i] = parse_script(argv[optind + i]);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        replay_t *replay = &replays[i];
+        replay->index = i;
+        if (num_scripts > 1) {
+            replay->script = &scripts[i];
+            replay->first_id = 0;
+            replay->end_id = scripts[i].num_ids;
+        } else {
+            int num_ids = scripts[0].num_ids;
+            replay->script = &scripts[0];
+            replay->first_id = (long)num_ids * i / nthreads;
+            replay->end_id = (long)num_ids * (i + 1) / nthreads;
+        }
+        replay->blocks = calloc(replay->script->num_ids, sizeof(block_t));
+        if (replay->blocks == NULL) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        pthread_mutex_init(&replay->mailbox.lock, NULL);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        replays[i].free_to = cross_free ? &replays[(i + 1) % nthreads].mailbox : NULL;
+    }
+
+    init_heap_segment(HEAP_SIZE);
+    if (!myinit(heap_segment_start(), heap_segment_size())) {
+        error(1, 0, "myinit() returned false");
+    }
+
+    printf("Replaying %d script%s on %d threads%s...\n", num_scripts,
+        num_scripts > 1 ? "s" : "", nthreads, cross_free ? " with cross-thread frees" : "");
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&replays[i].thread, NULL, replay_main, &replays[i]) != 0) {
+            error(1, 0, "Could not create replay thread.");
+        }
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(replays[i].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // blocks handed over by threads that finished after their neighbour
+    for (int i = 0; i < nthreads; i++) {
+        drain_mailbox(&replays[i]);
+    }
+
+    int nfailures = 0;
+    for (int i = 0; i < nthreads; i++) {
+        nfailures += replays[i].failed;
+    }
+    if (!validate_heap()) {
+        printf("validate_heap() returned false after replay\n");
+        nfailures++;
+    }
+
+    print_report(replays, nthreads, elapsed_seconds(&start, &end));
+
+    for (int i = 0; i < nthreads; i++) {
+        free(replays[i].blocks);
+        free(replays[i].mailbox.ptrs);
+    }
+    for (int i = 0; i < num_scripts; i++) {
+        free(scripts[i].ops);
+        free(scripts[i].blocks);
+    }
+    free(replays);
+    free(scripts);
+    return nfailures;
+}
+
+/* Function: replay_main
+ * ---------------------
+ * Thread body: replays every request of the script whose id falls in this
+ * thread's range, then verifies the payloads of the blocks still held.
+ */
+static void *replay_main(void *arg) {
+    replay_t *replay = arg;
+    script_t *script = replay->script;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int req = 0; req < script->num_ops && !replay->failed; req++) {
+        request_t *request = &script->ops[req];
+        if (request->id < replay->first_id || request->id >= replay->end_id) {
+            continue;
+        }
+        drain_mailbox(replay);
+        if (!replay_request(replay, request)) {
+            replay->failed = true;
+        }
+        replay->num_ops++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    replay->seconds = elapsed_seconds(&start, &end);
+
+    for (int id = replay->first_id; id < replay->end_id && !replay->failed; id++) {
+        if (!check_payload(replay, replay->blocks[id].ptr, replay->blocks[id].size,
+            id, "at exit")) {
+            replay->failed = true;
+        }
+    }
+    return NULL;
+}
+
+/* Function: replay_request
+ * ------------------------
+ * Sends one request to the allocator, timing the call including the wait
+ * for the allocator lock. New blocks are filled with the low-order byte of
+ * their id, and checked before they are resized or freed. Returns false
+ * if the allocator misbehaved.
+ */
+static bool replay_request(replay_t *replay, request_t *request) {
+    int id = request->id;
+    block_t *block = &replay->blocks[id];
+    struct timespec start;
+
+    if (request->op == ALLOC) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&allocator_lock);
+        void *p = mymalloc(request->size);
+        pthread_mutex_unlock(&allocator_lock);
+        record_latency(replay, &start);
+
+        if (p == NULL && request->size != 0) {
+            printf("thread %d [%s, line %d]: heap exhausted, malloc returned NULL\n",
+                replay->index, replay->script->name, request->lineno);
+            return false;
+        }
+        if (((uintptr_t)p) % ALIGNMENT != 0) {
+            printf("thread %d [%s, line %d]: block %p not aligned to %d bytes\n",
+                replay->index, replay->script->name, request->lineno, p, ALIGNMENT);
+            return false;
+        }
+        memset(p, id & 0xFF, request->size);
+        *block = (block_t){.ptr = p, .size = request->size};
+
+    } else if (request->op == REALLOC) {
+        if (!check_payload(replay, block->ptr, block->size, id, "pre-realloc-ing")) {
+            return false;
+        }
+        size_t preserved = block->size < request->size ? block->size : request->size;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&allocator_lock);
+        void *p = myrealloc(block->ptr, request->size);
+        pthread_mutex_unlock(&allocator_lock);
+        record_latency(replay, &start);
+
+        if (p == NULL && request->size != 0) {
+            printf("thread %d [%s, line %d]: heap exhausted, realloc returned NULL\n",
+                replay->index, replay->script->name, request->lineno);
+            return false;
+        }
+        if (!check_payload(replay, p, preserved, id, "post-realloc-ing")) {
+            return false;
+        }
+        memset(p, id & 0xFF, request->size);
+        *block = (block_t){.ptr = p, .size = request->size};
+
+    } else if (request->op == FREE) {
+        if (!check_payload(replay, block->ptr, block->size, id, "freeing")) {
+            return false;
+        }
+        void *p = block->ptr;
+        *block = (block_t){.ptr = NULL, .size = 0};
+        if (replay->free_to != NULL) {
+            post_mailbox(replay->free_to, p);
+            return true;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&allocator_lock);
+        myfree(p);
+        pthread_mutex_unlock(&allocator_lock);
+        record_latency(replay, &start);
+    }
+    return true;
+}
+
+/* Function: drain_mailbox
+ * -----------------------
+ * Frees every block other threads handed to this thread, timing each free
+ * as one of this thread's requests.
+ */
+static void drain_mailbox(replay_t *replay) {
+    mailbox_t *mailbox = &replay->mailbox;
+    pthread_mutex_lock(&mailbox->lock);
+    for (int i = 0; i < mailbox->count; i++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&allocator_lock);
+        myfree(mailbox->ptrs[i]);
+        pthread_mutex_unlock(&allocator_lock);
+        record_latency(replay, &start);
+    }
+    mailbox->count = 0;
+    pthread_mutex_unlock(&mailbox->lock);
+}
+
+/* Function: post_mailbox
+ * ----------------------
+ * Hands a block to the thread owning the mailbox, to be freed there.
+ */
+static void post_mailbox(mailbox_t *mailbox, void *ptr) {
+    pthread_mutex_lock(&mailbox->lock);
+    if (mailbox->count == mailbox->capacity) {
+        int capacity = mailbox->capacity ? mailbox->capacity * 2 : 64;
+        void **ptrs = realloc(mailbox->ptrs, capacity * sizeof(void *));
+        if (ptrs == NULL) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+        mailbox->ptrs = ptrs;
+        mailbox->capacity = capacity;
+    }
+    mailbox->ptrs[mailbox->count++] = ptr;
+    pthread_mutex_unlock(&mailbox->lock);
+}
+
+/* Function: check_payload
+ * -----------------------
+ * Verifies a block still holds the pattern written when it was allocated,
+ * i.e. that no other thread's request overwrote it.
+ */
+static bool check_payload(replay_t *replay, void *ptr, size_t size, int id, const char *op) {
+    for (size_t i = 0; i < size; i++) {
+        if (*((unsigned char *)ptr + i) != (id & 0xFF)) {
+            printf("thread %d [%s]: invalid payload data detected when %s address %p\n",
+                replay->index, replay->script->name, op, ptr);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function: record_latency
+ * ------------------------
+ * Adds the time since start to the thread's log2 latency histogram.
+ */
+static void record_latency(replay_t *replay, struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long ns = (end.tv_sec - start->tv_sec) * 1000000000L + (end.tv_nsec - start->tv_nsec);
+    int bucket = ns > 0 ? 63 - __builtin_clzl(ns) : 0;
+    replay->latency[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+}
+
+/* Function: elapsed_seconds
+ * -------------------------
+ * Returns the seconds between two monotonic clock readings.
+ */
+static double elapsed_seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Function: latency_percentile
+ * ----------------------------
+ * Returns the upper bound in ns of the histogram bucket holding the given
+ * fraction of the thread's requests.
+ */
+static unsigned long latency_percentile(replay_t *replay, double fraction) {
+    unsigned long total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        total += replay->latency[i];
+    }
+    unsigned long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += replay->latency[i];
+        if (total > 0 && seen >= fraction * total) {
+            return 2UL << i;
+        }
+    }
+    return 0;
+}
+
+/* Function: print_report
+ * ----------------------
+ * Prints aggregate throughput, then each thread's throughput, latency
+ * percentiles and histogram.
+ */
+static void print_report(replay_t *replays, int nthreads, double wall_seconds) {
+    long total_ops = 0;
+    for (int i = 0; i < nthreads; i++) {
+        total_ops += replays[i].num_ops;
+    }
+    printf("%ld requests in %.3f s: %.0f ops/sec aggregate\n", total_ops, wall_seconds,
+        wall_seconds > 0 ? total_ops / wall_seconds : 0);
+
+    for (int i = 0; i < nthreads; i++) {
+        replay_t *replay = &replays[i];
+        printf("thread %d [%s ids %d-%d]: %s%d requests, %.0f ops/sec, "
+            "latency p50 < %lu ns, p99 < %lu ns, p99.9 < %lu ns\n",
+            i, replay->script->name, replay->first_id, replay->end_id - 1,
+            replay->failed ? "FAILED after " : "", replay->num_ops,
+            replay->seconds > 0 ? replay->num_ops / replay->seconds : 0,
+            latency_percentile(replay, 0.50), latency_percentile(replay, 0.99),
+            latency_percentile(replay, 0.999));
+        printf("    histogram (ns bucket: count):");
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            if (replay->latency[b] > 0) {
+                printf(" %lu:%lu", 1UL << b, replay->latency[b]);
+            }
+        }
+        printf("\n");
+    }
+}
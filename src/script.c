@@ -0,0 +1,151 @@
+/*
+ * File: script.c
+ * --------------
+ * Reads text-based script files containing a sequence of allocator
+ * requests, shared by the test harness and the other script drivers.
+ *
+ * Written by jzelenski, updated by Nick Troccoli Winter 18-19
+ */
+
+#include <error.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "allocator.h"
+#include "script.h"
+
+// Initial capacity of ops when reading in from file, doubled when full
+// so generated scripts with millions of requests load in linear time
+const int OPS_RESIZE_AMOUNT = 500;
+
+const int MAX_SCRIPT_LINE_LEN = 1024;
+
+
+static bool read_line(char buffer[], size_t buffer_size, FILE *fp, int *pnread);
+static request_t parse_script_line(char *buffer, int i, int lineno, char *script_name);
+
+
+/* Fuction: parse_script
+ * ---------------------
+ * This function parses the script file at the specified path, and returns an
+ * object with info about it.  It expects one request per line, and adds each
+ * request's information to the ops array within the script.  This function
+ * throws an error if the file can't be opened, if a line is malformed, or if
+ * the file is too long to store each request on the heap.
+ */
+script_t parse_script(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        error(1, 0, "Could not open script file \"%s\".", path);
+    }
+
+    // Initialize a script object to store the information about this script
+    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
+    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    strncpy(script.name, basename, sizeof(script.name) - 1);
+    script.name[sizeof(script.name) - 1] = '\0';
+
+    int lineno = 0;
+    int nallocated = 0;
+    int maxid = 0;
+    char buffer[MAX_SCRIPT_LINE_LEN];
+
+    for (int i = 0; read_line(buffer, sizeof(buffer), fp, &lineno); i++) {
+
+        // Resize script->ops if we need more space for lines
+        if (i == nallocated) {
+            nallocated = nallocated ? 2 * nallocated : OPS_RESIZE_AMOUNT;
+            void *new_memory = realloc(script.ops, 
+                nallocated * sizeof(request_t));
+            if (!new_memory) {
+                free(script.ops);
+                error(1, 0, "Libc heap exhausted. Cannot continue.");
+            }
+            script.ops = new_memory;
+        }
+
+        script.ops[i] = parse_script_line(buffer, i, lineno, script.name);
+
+        if (script.ops[i].id > maxid) {
+            maxid = script.ops[i].id;
+        }
+
+        script.num_ops = i + 1;
+    }
+
+    fclose(fp);
+    script.num_ids = maxid + 1;
+
+    script.blocks = calloc(script.num_ids, sizeof(block_t));
+    if (!script.blocks) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
+    }
+
+    return script;
+}
+
+/* Function: read_line
+ * --------------------
+ * This function reads one line from the specified file and stores at most
+ * buffer_size characters from it in buffer, removing any trailing newline.
+ * It skips lines that are all-whitespace or that contain comments (begin with
+ * # as first non-whitespace character).  When reading a line, it increments the
+ * counter pointed to by `pnread` once for each line read/skipped. This function
+ * returns true if did read a valid line eventually, or false otherwise.
+ */
+static bool read_line(char buffer[], size_t buffer_size, FILE *fp, 
+    int *pnread) {
+
+    while (true) {
+        if (fgets(buffer, buffer_size, fp) == NULL) {
+            return false;
+        }
+
+        (*pnread)++;
+
+        // remove any trailing newline
+        if (buffer[strlen(buffer)-1] == '\n') {
+            buffer[strlen(buffer)-1] ='\0'; 
+        }
+
+        /* Stop only if this line is not a comment line (comment lines start
+         * with # as first non-whitespace character)
+         */
+        char ch;
+        if (sscanf(buffer, " %c", &ch) == 1 && ch != '#') {
+            return true;
+        }
+    }
+}
+
+/* Function: parse_script_line
+ * ---------------------------
+ * This function parses the provided line from the script and returns info
+ * about it as a request_t object filled in with the type of the request,
+ * the size, the ID, and the line number.  If the line is malformed, this
+ * function throws an error.
+ */
+static request_t parse_script_line(char *buffer, int i, int lineno, 
+    char *script_name) {
+
+    request_t request = { .lineno = lineno, .op = 0, .size = 0};
+
+    char request_char;
+    int nscanned = sscanf(buffer, " %c %d %zu", &request_char, 
+        &request.id, &request.size);
+    if (request_char == 'a' && nscanned == 3) {
+        request.op = ALLOC;
+    } else if (request_char == 'r' && nscanned == 3) {
+        request.op = REALLOC;
+    } else if (request_char == 'f' && nscanned == 2) {
+        request.op = FREE;
+    }
+
+    if (!request.op || request.id < 0 || request.size > MAX_REQUEST_SIZE) {
+        error(1, 0, "Line %d of script file '%s' is malformed.", 
+            lineno, script_name);
+    }
+
+    return request;
+}
@@ -0,0 +1,55 @@
+/* File: script.h
+ * --------------
+ * Types for allocator request scripts, and the parser that reads them.
+ * A script has one request per line:
+ *      a id size   (allocate)
+ *      r id size   (reallocate)
+ *      f id        (free)
+ * Blank lines and lines starting with # are skipped.
+ */
+
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+#include <stddef.h> // for size_t
+
+
+// enum and struct for a single allocator request
+enum request_type {
+    ALLOC = 1,
+    FREE,
+    REALLOC
+};
+typedef struct {
+    enum request_type op;   // type of request
+    int id;                 // id for free() to use later
+    size_t size;            // num bytes for alloc/realloc request
+    int lineno;             // which line in file
+} request_t;
+
+// struct for facts about a single malloc'ed block
+typedef struct {
+    void *ptr;
+    size_t size;
+} block_t;
+
+// struct for info for one script file
+typedef struct {
+    char name[128];     // short name of script
+    request_t *ops;     // array of requests read from script
+    int num_ops;        // number of requests
+    int num_ids;        // number of distinct block ids
+    block_t *blocks;    // array of memory blocks malloc returns when executing
+    size_t peak_size;   // total payload bytes at peak in-use
+} script_t;
+
+
+/* Function: parse_script
+ * ----------------------
+ * Parses the script file at the specified path. The caller owns the ops
+ * and blocks arrays of the result. Exits with an error if the file can't
+ * be opened or a line is malformed.
+ */
+script_t parse_script(const char *filename);
+
+
+#endif
@@ -1,23 +1,47 @@
 /* File: segment.c
  * ---------------
  * Handles low-level storage underneath the heap allocator. It reserves
- * the large memory segment using the OS-level mmap facility.
+ * the large memory segment using the OS-level mmap facility, either as
+ * anonymous memory or as a shared mapping of a file that outlives the
+ * process, moves pages within it, and saves and restores snapshots of
+ * the heap in use.
  *
  * Written by jzelenski, updated Spring 2018
  */
 
+#define _GNU_SOURCE     // for mremap
 #include "segment.h"
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Place segment at fixed address, as default addresses are quite high
  * and easily mistaken for stack addresses.
  */
 #define HEAP_START_HINT (void *)0x107000000L
 
+// Snapshot files start with this header, then the allocator state; the
+// heap bytes follow at a page-aligned offset so they can be mapped
+#define SNAPSHOT_MAGIC 0x68656170736e6170UL
+typedef struct {
+    uint64_t magic;
+    uint64_t segment_start;
+    uint64_t segment_size;
+    uint64_t heap_bytes;
+    uint64_t state_bytes;
+    uint64_t heap_offset;
+} snapshot_header;
+
 // Static means these variables are only visible within this file
 static void *segment_start = NULL;
 static size_t segment_size = 0;
+static bool segment_shared = false;
 
 void *heap_segment_start() {
     return segment_start;
@@ -30,7 +54,7 @@ size_t heap_segment_size() {
 void *init_heap_segment(size_t total_size) {
     // Discard any previous segment via munmap
     if (segment_start != NULL) {
-        if (munmap(segment_start, total_size) == -1) return NULL;
+        if (munmap(segment_start, segment_size) == -1) return NULL;
         segment_start = NULL;
         segment_size = 0;
     }
@@ -39,5 +63,145 @@ void *init_heap_segment(size_t total_size) {
     segment_start = mmap(HEAP_START_HINT, total_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
     assert(segment_start != MAP_FAILED);
     segment_size = total_size;
+    segment_shared = false;
     return segment_start;
 }
+
+void *init_heap_segment_file(const char *path, size_t total_size) {
+    // Discard any previous segment via munmap
+    if (segment_start != NULL) {
+        if (munmap(segment_start, segment_size) == -1) return NULL;
+        segment_start = NULL;
+        segment_size = 0;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || 
+        ((size_t)st.st_size < total_size && ftruncate(fd, total_size) == -1)) {
+        close(fd);
+        return NULL;
+    }
+
+    // The heap holds pointers into itself, so it must map at the same
+    // address in every process; older kernels take the flag as a hint only
+    void *start = mmap(HEAP_START_HINT, total_size, PROT_READ|PROT_WRITE, 
+        MAP_SHARED|MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+    if (start == MAP_FAILED) return NULL;
+    if (start != HEAP_START_HINT) {
+        munmap(start, total_size);
+        return NULL;
+    }
+    segment_start = start;
+    segment_size = total_size;
+    segment_shared = true;
+    return segment_start;
+}
+
+bool sync_heap_segment() {
+    return segment_start != NULL && msync(segment_start, segment_size, MS_SYNC) == 0;
+}
+
+bool move_heap_pages(void *dest, void *src, size_t len) {
+    char *start = segment_start, *end = start + segment_size;
+    if (segment_start == NULL || segment_shared || len == 0 ||
+        (char *)src < start || (char *)src + len > end || 
+        (char *)dest < start || (char *)dest + len > end) {
+        return false;
+    }
+
+    // the pages leave a hole in the segment: map the fresh ones to fill it
+    // before anything moves
+    void *fresh = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (fresh == MAP_FAILED) return false;
+    if (mremap(src, len, len, MREMAP_MAYMOVE|MREMAP_FIXED, dest) == MAP_FAILED) {
+        munmap(fresh, len);
+        return false;
+    }
+    if (mremap(fresh, len, len, MREMAP_MAYMOVE|MREMAP_FIXED, src) != MAP_FAILED) return true;
+
+    // the hole could not be filled: move the pages back, which leaves the
+    // hole at dest, where nothing was kept yet, and fill that one instead
+    if (mremap(dest, len, len, MREMAP_MAYMOVE|MREMAP_FIXED, src) == MAP_FAILED ||
+        mremap(fresh, len, len, MREMAP_MAYMOVE|MREMAP_FIXED, dest) == MAP_FAILED) {
+        abort();    // a hole in the heap, which no caller can recover from
+    }
+    return false;
+}
+
+static bool pwrite_all(int fd, const void *buffer, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t nwritten = pwrite(fd, buffer, len, offset);
+        if (nwritten <= 0) return false;
+        buffer = (const char *)buffer + nwritten;
+        len -= nwritten;
+        offset += nwritten;
+    }
+    return true;
+}
+
+static bool pread_all(int fd, void *buffer, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t nread = pread(fd, buffer, len, offset);
+        if (nread <= 0) return false;
+        buffer = (char *)buffer + nread;
+        len -= nread;
+        offset += nread;
+    }
+    return true;
+}
+
+static size_t round_to_page(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+bool write_heap_snapshot(const char *path, void *heap_start, size_t heap_size, size_t heap_bytes,
+    const void *state, size_t state_bytes) {
+    if (heap_start == NULL || heap_bytes > heap_size) return false;
+
+    snapshot_header header = {.magic = SNAPSHOT_MAGIC, .segment_start = (uintptr_t)heap_start,
+        .segment_size = heap_size, .heap_bytes = heap_bytes, .state_bytes = state_bytes,
+        .heap_offset = round_to_page(sizeof(header) + state_bytes)};
+
+    // the heap may be a mapping of the file at path, restored from it: write
+    // a new file and rename it over, so the mapped one is never truncated
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        return false;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return false;
+    bool written = pwrite_all(fd, &header, sizeof(header), 0) &&
+        pwrite_all(fd, state, state_bytes, sizeof(header)) &&
+        pwrite_all(fd, heap_start, heap_bytes, header.heap_offset) &&
+        ftruncate(fd, header.heap_offset + round_to_page(heap_bytes)) == 0;
+    written = close(fd) == 0 && written && rename(tmp_path, path) == 0;
+    if (!written) {
+        unlink(tmp_path);
+    }
+    return written;
+}
+
+bool map_heap_snapshot(const char *path, void *heap_start, size_t heap_size, void *state,
+    size_t *state_bytes) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+    snapshot_header header;
+    bool valid = pread_all(fd, &header, sizeof(header), 0) && header.magic == SNAPSHOT_MAGIC &&
+        header.segment_start == (uintptr_t)heap_start && header.segment_size == heap_size &&
+        header.state_bytes <= *state_bytes &&
+        pread_all(fd, state, header.state_bytes, sizeof(header));
+
+    // private mapping: pages are shared with the file until written
+    if (valid && header.heap_bytes > 0) {
+        void *start = mmap(heap_start, round_to_page(header.heap_bytes), PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_FIXED, fd, header.heap_offset);
+        valid = start == heap_start;
+    }
+    close(fd);
+    if (valid) *state_bytes = header.state_bytes;
+    return valid;
+}
@@ -6,6 +6,7 @@
 
 #ifndef _SEGMENT_H_
 #define _SEGMENT_H_
+#include <stdbool.h> // for bool
 #include <stddef.h> // for size_t
 
 
@@ -22,6 +23,55 @@ void *init_heap_segment(size_t total_size);
 
 
 
+/* Function: init_heap_segment_file
+ * --------------------------------
+ * Like init_heap_segment, but the segment is a shared mapping of the file
+ * at path, created or extended (sparse) to total_size bytes, so its
+ * contents persist after the process exits. The file is always mapped at
+ * the same address; the function returns NULL if the file cannot be
+ * opened or that address is not available.
+ */
+void *init_heap_segment_file(const char *path, size_t total_size);
+
+
+/* Function: sync_heap_segment
+ * ---------------------------
+ * Writes a file-backed segment's changes out to its file. Returns false
+ * on error or if there is no segment.
+ */
+bool sync_heap_segment();
+
+
+/* Function: move_heap_pages
+ * -------------------------
+ * Moves len bytes of whole pages from src to dest within an anonymous
+ * segment by remapping them rather than copying, and leaves zeroed pages
+ * at src. Both addresses must be page-aligned and the ranges must not
+ * overlap. Returns false, with src intact, for a file-backed segment or
+ * if the kernel refuses; the caller then copies instead. The pages at
+ * dest may have been replaced with zeroed ones by then.
+ */
+bool move_heap_pages(void *dest, void *src, size_t len);
+
+
+/* Functions: write_heap_snapshot, map_heap_snapshot
+ * --------------------------------------------------
+ * write_heap_snapshot saves the first heap_bytes of the heap segment at
+ * heap_start and state_bytes of allocator state to the file at path. It
+ * writes path.tmp and renames it over path, so a heap restored from path
+ * keeps its mapping and can be snapshot to path again.
+ * map_heap_snapshot reads the state back into state, which has room for
+ * *state_bytes bytes and receives the number read, and maps the saved bytes
+ * copy-on-write over the start of the segment. The segment must have the
+ * same address and size as when the snapshot was written. Both return false
+ * on error. Allocators call these from heap_snapshot and heap_restore.
+ */
+bool write_heap_snapshot(const char *path, void *heap_start, size_t heap_size, size_t heap_bytes,
+    const void *state, size_t state_bytes);
+bool map_heap_snapshot(const char *path, void *heap_start, size_t heap_size, void *state,
+    size_t *state_bytes);
+
+
 /* Functions: heap_segment_start, heap_segment_size
  * ------------------------------------------------
  * heap_segment_start returns the base address of the current heap segment
@@ -0,0 +1,110 @@
+/* File: size_tuning.c
+ * -------------------
+ * Histogram of request sizes and the thresholds tuned from it. Sizes are
+ * counted in granule-wide bins, with one more bin for everything larger
+ * than SIZE_TUNING_MAX_BYTES; a threshold is the top of the bin where the
+ * running share of requests reaches its percentile. The counts are halved
+ * at each retuning, so the thresholds follow the recent requests.
+ *
+ * The totals for HEAP_TUNING live in shared memory mapped at startup, so
+ * worker processes forked by the test harness add to the same counts, and
+ * only the process that mapped them writes the file.
+ */
+
+#include "size_tuning.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define BIN_COUNT (SIZE_TUNING_MAX_BYTES / SIZE_TUNING_GRANULE + 1)
+
+// Static means these variables are only visible within this file
+static unsigned long bins[BIN_COUNT];       // since the last reset, decayed
+static atomic_ulong *totals;                // over the run, or NULL without HEAP_TUNING
+static unsigned long countdown;             // requests until the next retuning
+static size_t split_bytes;
+static size_t quick_list_bytes;
+static const char *dump_path;               // HEAP_TUNING
+static pid_t dump_pid;                      // the process that writes it
+
+
+static size_t bin_of(size_t size) {
+    if (size > SIZE_TUNING_MAX_BYTES) return BIN_COUNT - 1;
+    return size == 0 ? 0 : (size - 1) / SIZE_TUNING_GRANULE;
+}
+
+static size_t percentile_bytes(const unsigned long *counts, int percent) {
+    unsigned long total = 0;
+    for (size_t i = 0; i < BIN_COUNT; i++) {
+        total += counts[i];
+    }
+
+    // the running count reaches percent of the total in some bin
+    unsigned long target = (total * percent + 99) / 100, seen = 0;
+    size_t i = 0;
+    while (i < BIN_COUNT - 1 && (seen += counts[i]) < target) {
+        i++;
+    }
+    return i < BIN_COUNT - 1 ? (i + 1) * SIZE_TUNING_GRANULE : SIZE_TUNING_MAX_BYTES;
+}
+
+static void dump_tuning(void) {
+    if (getpid() != dump_pid) return;
+
+    unsigned long counts[BIN_COUNT];
+    for (size_t i = 0; i < BIN_COUNT; i++) {
+        counts[i] = atomic_load_explicit(&totals[i], memory_order_relaxed);
+    }
+    FILE *fp = fopen(dump_path, "w");
+    if (fp == NULL) return;
+    fprintf(fp, "# written by HEAP_TUNING from the request sizes of a run\n");
+    fprintf(fp, "TUNING_FLAGS = -DTUNED_SPLIT_BYTES=%zu -DTUNED_QUICK_LIST_BYTES=%zu\n",
+        percentile_bytes(counts, SIZE_TUNING_SPLIT_PERCENTILE),
+        percentile_bytes(counts, SIZE_TUNING_QUICK_LIST_PERCENTILE));
+    fclose(fp);
+}
+
+// Runs before main, so the totals are mapped before any worker is forked
+__attribute__((constructor)) static void start_dump(void) {
+    dump_path = getenv("HEAP_TUNING");
+    if (dump_path == NULL) return;
+    void *shared = mmap(NULL, BIN_COUNT * sizeof(atomic_ulong), PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return;
+    totals = shared;
+    dump_pid = getpid();
+    atexit(dump_tuning);
+}
+
+void size_tuning_reset(size_t default_split_bytes, size_t default_quick_list_bytes) {
+    memset(bins, 0, sizeof(bins));
+    countdown = SIZE_TUNING_INTERVAL;
+    split_bytes = default_split_bytes;
+    quick_list_bytes = default_quick_list_bytes;
+}
+
+void size_tuning_record(size_t size) {
+    size_t bin = bin_of(size);
+    bins[bin]++;
+    if (totals != NULL) atomic_fetch_add_explicit(&totals[bin], 1, memory_order_relaxed);
+
+    if (--countdown == 0) {
+        countdown = SIZE_TUNING_INTERVAL;
+        split_bytes = percentile_bytes(bins, SIZE_TUNING_SPLIT_PERCENTILE);
+        quick_list_bytes = percentile_bytes(bins, SIZE_TUNING_QUICK_LIST_PERCENTILE);
+        for (size_t i = 0; i < BIN_COUNT; i++) {
+            bins[i] /= 2;
+        }
+    }
+}
+
+size_t size_tuning_split_bytes(void) {
+    return split_bytes;
+}
+
+size_t size_tuning_quick_list_bytes(void) {
+    return quick_list_bytes;
+}
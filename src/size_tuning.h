@@ -0,0 +1,60 @@
+/* File: size_tuning.h
+ * -------------------
+ * Interface to the size tuner. It keeps a histogram of request sizes and,
+ * every SIZE_TUNING_INTERVAL requests, retunes two thresholds from it: the
+ * smallest free block worth splitting off a larger one, and the largest
+ * block kept on a quick-list. Each retuning halves the counts, so a
+ * request weighs half as much with every interval that passes. A split-off
+ * block smaller than most requests would rarely be reused, and
+ * quick-listing sizes that are seldom asked for again only holds memory
+ * back from coalescing.
+ *
+ * Running a program with HEAP_TUNING=path writes the tuning chosen over
+ * the whole run, including any worker processes it forks
+ * (test_harness -j), to path as a make fragment; the Makefile includes
+ * tuning.mk, so that a build with it has the thresholds compiled in
+ * (TUNED_SPLIT_BYTES, TUNED_QUICK_LIST_BYTES) and records nothing.
+ */
+
+#ifndef _SIZE_TUNING_H_
+#define _SIZE_TUNING_H_
+#include <stddef.h>  // for size_t
+
+// requests between retunings
+#define SIZE_TUNING_INTERVAL 256
+
+// histogram bins are this many bytes wide, up to SIZE_TUNING_MAX_BYTES
+#define SIZE_TUNING_GRANULE 8
+#define SIZE_TUNING_MAX_BYTES 1024
+
+// shares of requests, in percent, at or below each threshold
+#define SIZE_TUNING_SPLIT_PERCENTILE 10
+#define SIZE_TUNING_QUICK_LIST_PERCENTILE 50
+
+
+/* Function: size_tuning_reset
+ * ---------------------------
+ * Empties the histogram and sets the thresholds to the given defaults,
+ * e.g. when the allocator is reset by myinit.
+ */
+void size_tuning_reset(size_t split_bytes, size_t quick_list_bytes);
+
+
+/* Function: size_tuning_record
+ * ----------------------------
+ * Counts a request of size bytes, and retunes every SIZE_TUNING_INTERVAL.
+ */
+void size_tuning_record(size_t size);
+
+
+/* Functions: size_tuning_split_bytes, size_tuning_quick_list_bytes
+ * ----------------------------------------------------------------
+ * size_tuning_split_bytes returns the smallest payload of a free block
+ * worth splitting off. size_tuning_quick_list_bytes returns the largest
+ * payload worth keeping on a quick-list. Both are multiples of the granule.
+ */
+size_t size_tuning_split_bytes(void);
+size_t size_tuning_quick_list_bytes(void);
+
+
+#endif
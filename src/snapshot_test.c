@@ -0,0 +1,95 @@
+/*
+ * File: snapshot_test.c
+ * ---------------------
+ * Checks heap_snapshot and heap_restore beyond the single snapshot and
+ * restore of the harness's -k: a heap is snapshot, changed and restored,
+ * then changed, snapshot again to the same file (which the restored heap
+ * is mapped from) and restored again. After each restore the blocks must
+ * hold what they held at the snapshot, and the heap must validate and
+ * keep serving requests.
+ *
+ *      snapshot_test_<allocator> [check...]
+ *
+ * When you compile using `make`, one version is built for each
+ * allocator. With no arguments, every check runs. Exits with the number
+ * of failed checks.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "allocator.h"
+#include "segment.h"
+#include "test_util.h"
+
+
+/* FUNCTION PROTOTYPES */
+
+
+static bool check_restore(void);
+static bool check_resnapshot(void);
+static bool snapshot_round(const char *path, test_blocks *blocks, int round);
+
+
+static const check_t CHECKS[] = {
+    {"restore", check_restore},
+    {"snapshot over the restored heap's file", check_resnapshot},
+};
+
+
+/* Function: main
+ * --------------
+ * Runs the checks named on the command line, or all of them.
+ */
+int main(int argc, char *argv[]) {
+    return run_checks(CHECKS, sizeof(CHECKS) / sizeof(CHECKS[0]), argv + 1, argc - 1);
+}
+
+/* Function: check_restore
+ * -----------------------
+ * One snapshot and restore, then more requests on the restored heap.
+ */
+static bool check_restore(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/heap_snapshot_test.%d", (int)getpid());
+    test_blocks blocks = {{NULL}};
+    mutate_blocks(&blocks, 0);
+    bool passed = snapshot_round(path, &blocks, 1);
+    unlink(path);
+    mutate_blocks(&blocks, 2);
+    return passed && validate_heap() && verify_blocks(&blocks);
+}
+
+/* Function: check_resnapshot
+ * --------------------------
+ * A snapshot and restore, then a second snapshot to the same file while
+ * the restored heap is still mapped from it, and a restore of that one.
+ */
+static bool check_resnapshot(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/heap_snapshot_test.%d", (int)getpid());
+    test_blocks blocks = {{NULL}};
+    mutate_blocks(&blocks, 0);
+    bool passed = snapshot_round(path, &blocks, 1);
+    mutate_blocks(&blocks, 2);
+    passed = passed && snapshot_round(path, &blocks, 3);
+    unlink(path);
+    mutate_blocks(&blocks, 4);
+    return passed && validate_heap() && verify_blocks(&blocks);
+}
+
+/* Function: snapshot_round
+ * ------------------------
+ * Snapshots the heap to path, changes the blocks with the given round,
+ * and restores the snapshot. Returns whether the restored heap validates
+ * and the blocks hold what they held at the snapshot, as blocks then does.
+ */
+static bool snapshot_round(const char *path, test_blocks *blocks, int round) {
+    test_blocks saved = *blocks;
+    if (!heap_snapshot(path)) {
+        return false;
+    }
+    mutate_blocks(blocks, round);
+    *blocks = saved;
+    return heap_restore(path) && validate_heap() && verify_blocks(blocks);
+}
@@ -12,66 +12,98 @@
  * Written by jzelenski, updated by Nick Troccoli Winter 18-19
  */
 
+#include <errno.h>
 #include <error.h>
 #include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 #include "allocator.h"
+#include "heap_profile.h"
+#include "perf_counters.h"
+#include "script.h"
 #include "segment.h"
 
 
 /* TYPE DECLARATIONS */
 
 
-// enum and struct for a single allocator request
-enum request_type {
-    ALLOC = 1,
-    FREE,
-    REALLOC
-};
+// command-line options shared by the evaluation functions
 typedef struct {
-    enum request_type op;   // type of request
-    int id;                 // id for free() to use later
-    size_t size;            // num bytes for alloc/realloc request
-    int lineno;             // which line in file
-} request_t;
-
-// struct for facts about a single malloc'ed block
+    bool quiet;             // skip validate_heap between requests
+    int sample_interval;    // requests between utilization samples, 0 for none
+    FILE *samples_fp;       // where samples are written
+    int jobs;               // number of worker processes
+    bool counters;          // measure allocator calls with perf counters
+    int snapshot_op;        // request before which the heap is snapshot, -1 for none
+    size_t profile_period;  // heap profile sample period in bytes, 0 for none
+} options_t;
+
+// result of one script evaluated by a worker process, followed on the
+// pipe by output_len bytes of its stdout and samples_len bytes of samples
 typedef struct {
-    void *ptr;
-    size_t size;
-} block_t;
+    bool success;
+    int util;
+    size_t output_len;
+    size_t samples_len;
+} worker_result_t;
 
-// struct for info for one script file
-typedef struct {
-    char name[128];     // short name of script
-    request_t *ops;     // array of requests read from script
-    int num_ops;        // number of requests
-    int num_ids;        // number of distinct block ids
-    block_t *blocks;    // array of memory blocks malloc returns when executing
-    size_t peak_size;   // total payload bytes at peak in-use
-} script_t;
 
-// Amount by which we resize ops when needed when reading in from file
-const int OPS_RESIZE_AMOUNT = 500;
+/* CONSTANTS */
 
-const int MAX_SCRIPT_LINE_LEN = 1024;
 
 const long HEAP_SIZE = 1L << 32;
 
+const char *DEFAULT_SAMPLES_PATH = "utilization.csv";
+
+const char *PROFILE_SUFFIX = ".prof";
+
+const char *REQUEST_NAMES[] = {[ALLOC] = "malloc", [REALLOC] = "realloc", [FREE] = "free"};
+
+
+/* The heap profiler is linked in only with the allocators that sample */
+#pragma weak heap_profile_start
+#pragma weak heap_profile_dump
+
+/* Counters around allocator calls, open only while a script runs with -c */
+static perf_counters counters;
+static perf_totals request_totals[REALLOC + 1];
+static bool counting = false;
+
+/* Time of allocator calls, measured after the snapshot of a script run with -k */
+static bool timing = false;
+static struct timespec call_start;
+static long timed_ns;
+static unsigned long timed_calls;
+
 
 /* FUNCTION PROTOTYPES */
 
 
-static int test_scripts(char *script_names[], int num_script_names, bool quiet);
-static bool read_line(char buffer[], size_t buffer_size, FILE *fp, int *pnread);
-static script_t parse_script(const char *filename);
-static request_t parse_script_line(char *buffer, int i, int lineno, char *script_name);
-static size_t eval_correctness(script_t *script, bool quiet, bool *success);
+static int test_scripts(char *script_names[], int num_script_names, options_t *options);
+static int test_scripts_parallel(char *script_names[], int num_script_names, options_t *options);
+static bool evaluate_script(const char *script_name, options_t *options, int *util);
+static void run_worker(int worker, int write_fd, char *script_names[], int num_script_names,
+    options_t *options);
+static bool write_all(int fd, const void *buffer, size_t len);
+static bool read_all(int fd, void *buffer, size_t len);
+static size_t eval_correctness(script_t *script, options_t *options, bool *success);
+static bool snapshot_and_restore(script_t *script, int req);
+static void dump_profile(const char *script_name);
+static void open_counters(void);
+static void close_counters(void);
+static void print_counters(void);
+static void counters_start(void);
+static void counters_stop(enum request_type op);
+static void write_sample(FILE *fp, script_t *script, int req, void *heap_end, size_t cur_size);
 static void *eval_malloc(int req, size_t requested_size, script_t *script, bool *failptr);
 static void *eval_realloc(int req, size_t requested_size, script_t *script, bool *failptr);
 static bool verify_block(void *ptr, size_t size, script_t *script, int lineno);
@@ -84,18 +116,64 @@ static void allocator_error(script_t *script, int lineno, char* format, ...);
 
 /* Function: main
  * --------------
- * The main function parses command-line arguments (currently only -q for quiet)
- * and any script files that follow and runs the heap allocator on the specified
- * script files.  It outputs statistics about the run of each script, such as
- * the number of successful runs, number of failures, and average utilization.
+ * The main function parses command-line arguments and any script files that
+ * follow and runs the heap allocator on the specified script files.  It
+ * outputs statistics about the run of each script, such as the number of
+ * successful runs, number of failures, and average utilization.
+ * Options:
+ *  -q      quiet, skip validate_heap between requests
+ *  -s N    sample heap utilization every N requests
+ *  -o PATH write the samples as CSV to PATH (default utilization.csv)
+ *  -j N    evaluate the scripts in N worker processes
+ *  -c      count instructions, cycles and misses of allocator calls
+ *  -k K    snapshot the heap after K requests, restore it from the snapshot,
+ *          and measure only the requests that follow
+ *  -p N    sample the heap profile every N allocated bytes on average (0 for
+ *          HEAP_PROFILE_DEFAULT_PERIOD), and write each script's profile to
+ *          its base name with .prof
  */
 int main(int argc, char *argv[]) {
     // Parse command line arguments
-    char c;
-    bool quiet = false;
-    while ((c = getopt(argc, argv, "q")) != EOF) {
+    int c;
+    options_t options = {.quiet = false, .sample_interval = 0, .samples_fp = NULL, .jobs = 1,
+        .counters = false, .snapshot_op = -1, .profile_period = 0};
+    const char *samples_path = DEFAULT_SAMPLES_PATH;
+    while ((c = getopt(argc, argv, "qs:o:j:ck:p:")) != EOF) {
         if (c == 'q') {
-            quiet = true;
+            options.quiet = true;
+        } else if (c == 's') {
+            options.sample_interval = atoi(optarg);
+            if (options.sample_interval <= 0) {
+                error(1, 0, "Sample interval must be a positive number of requests.");
+            }
+        } else if (c == 'o') {
+            samples_path = optarg;
+        } else if (c == 'c') {
+            options.counters = true;
+        } else if (c == 'k') {
+            options.snapshot_op = atoi(optarg);
+            if (options.snapshot_op < 0) {
+                error(1, 0, "Snapshot request must not be negative.");
+            }
+        } else if (c == 'p') {
+            char *end;
+            long period = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || period < 0) {
+                error(1, 0, "Profile period must be a number of bytes, or 0 for the default.");
+            }
+            if (period == 0) {
+                period = HEAP_PROFILE_DEFAULT_PERIOD;
+            }
+            if (heap_profile_start == NULL) {
+                error(1, 0, "This allocator has no heap profiler.");
+            }
+            options.profile_period = period;
+            heap_profile_start(period);
+        } else if (c == 'j') {
+            options.jobs = atoi(optarg);
+            if (options.jobs <= 0) {
+                error(1, 0, "Number of jobs must be positive.");
+            }
         }
     }
     if (optind >= argc) {
@@ -104,17 +182,36 @@ int main(int argc, char *argv[]) {
 
     // disable stdout buffering, all printfs display to terminal immediately
     setvbuf(stdout, NULL, _IONBF, 0);
-    
-    return test_scripts(argv + optind, argc - optind, quiet);
+
+    if (options.sample_interval > 0) {
+        options.samples_fp = fopen(samples_path, "w");
+        if (options.samples_fp == NULL) {
+            error(1, 0, "Could not open samples file \"%s\".", samples_path);
+        }
+        fprintf(options.samples_fp, "script,request,heap_end,cur_size,peak_size,heap_bytes,"
+            "free_blocks,free_bytes,largest_free_block,utilization,fragmentation\n");
+    }
+
+    int nfailures;
+    if (options.jobs > 1 && argc - optind > 1) {
+        nfailures = test_scripts_parallel(argv + optind, argc - optind, &options);
+    } else {
+        nfailures = test_scripts(argv + optind, argc - optind, &options);
+    }
+
+    if (options.samples_fp != NULL) {
+        fclose(options.samples_fp);
+    }
+    return nfailures;
 }
 
 /* Function: test_scripts
  * ----------------------
  * Runs the scripts with names in the specified array, with more or less output
- * depending on the value of `quiet`.  Returns the number of failures during all
+ * depending on the options.  Returns the number of failures during all
  * the tests.
  */
-static int test_scripts(char *script_names[], int num_script_names, bool quiet) {
+static int test_scripts(char *script_names[], int num_script_names, options_t *options) {
     int nsuccesses = 0;
     int nfailures = 0;
 
@@ -122,41 +219,241 @@ static int test_scripts(char *script_names[], int num_script_names, bool quiet)
     int total_util = 0;
 
     for (int i = 0; i < num_script_names; i++) {
-        script_t script = parse_script(script_names[i]);
-
-        // Evaluate this script and record the results
-        printf("\nEvaluating allocator on %s...", script.name);
-        bool success;
-        size_t used_segment = eval_correctness(&script, quiet, &success);
-        if (success) {
-            printf("successfully serviced %d requests. (payload/segment = %zu/%zu)", 
-                script.num_ops, script.peak_size, used_segment);
-            if (used_segment > 0) {
-                total_util += (100 * script.peak_size) / used_segment;
-            }
+        int util;
+        if (evaluate_script(script_names[i], options, &util)) {
+            total_util += util;
             nsuccesses++;
         } else {
             nfailures++;
         }
+    }
+
+    if (nsuccesses) {
+        printf("\nUtilization averaged %d%%\n", total_util / nsuccesses);
+    }
+    return nfailures;
+}
 
-        free(script.ops);
-        free(script.blocks);
+/* Function: test_scripts_parallel
+ * -------------------------------
+ * Like test_scripts, but forks options->jobs worker processes. Worker k
+ * evaluates scripts k, k + jobs, k + 2*jobs, ... in its own address space
+ * (so each has its own heap segment), and sends each result with the
+ * output and samples it produced over a pipe. Reading the pipes round-robin
+ * yields the results in the original script order, which are printed just
+ * as the sequential run would print them.
+ */
+static int test_scripts_parallel(char *script_names[], int num_script_names,
+    options_t *options) {
+
+    int njobs = options->jobs < num_script_names ? options->jobs : num_script_names;
+    int *read_fds = malloc(njobs * sizeof(int));
+    pid_t *pids = malloc(njobs * sizeof(pid_t));
+    if (read_fds == NULL || pids == NULL) {
+        error(1, 0, "Libc heap exhausted. Cannot continue.");
     }
 
+    // anything buffered now would be written again by every worker
+    if (options->samples_fp != NULL) {
+        fflush(options->samples_fp);
+    }
+
+    for (int k = 0; k < njobs; k++) {
+        int fds[2];
+        if (pipe(fds) == -1) {
+            error(1, errno, "Could not create pipe for worker %d", k);
+        }
+        pids[k] = fork();
+        if (pids[k] == -1) {
+            error(1, errno, "Could not fork worker %d", k);
+        }
+        if (pids[k] == 0) {
+            for (int j = 0; j < k; j++) {
+                close(read_fds[j]);
+            }
+            close(fds[0]);
+            run_worker(k, fds[1], script_names, num_script_names, options);
+            _exit(0);
+        }
+        close(fds[1]);
+        read_fds[k] = fds[0];
+    }
+
+    int nsuccesses = 0;
+    int nfailures = 0;
+    int total_util = 0;
+    for (int i = 0; i < num_script_names; i++) {
+        int fd = read_fds[i % njobs];
+        worker_result_t result;
+        char *output = NULL;
+        char *samples = NULL;
+        bool received = read_all(fd, &result, sizeof(result)) &&
+            (output = malloc(result.output_len + 1)) != NULL &&
+            (samples = malloc(result.samples_len + 1)) != NULL &&
+            read_all(fd, output, result.output_len) &&
+            read_all(fd, samples, result.samples_len);
+
+        if (!received) {
+            printf("\nEvaluating allocator on %s...worker %d exited without a result\n",
+                script_names[i], i % njobs);
+            nfailures++;
+        } else {
+            fwrite(output, 1, result.output_len, stdout);
+            if (options->samples_fp != NULL) {
+                fwrite(samples, 1, result.samples_len, options->samples_fp);
+            }
+            if (result.success) {
+                total_util += result.util;
+                nsuccesses++;
+            } else {
+                nfailures++;
+            }
+        }
+        free(output);
+        free(samples);
+    }
+
+    for (int k = 0; k < njobs; k++) {
+        close(read_fds[k]);
+        waitpid(pids[k], NULL, 0);
+    }
+    free(read_fds);
+    free(pids);
+
     if (nsuccesses) {
         printf("\nUtilization averaged %d%%\n", total_util / nsuccesses);
     }
     return nfailures;
 }
 
+/* Function: run_worker
+ * --------------------
+ * Body of worker process `worker`: evaluates its share of the scripts,
+ * capturing stdout and the samples of each into memory, and writes a
+ * worker_result_t followed by both to write_fd.
+ */
+static void run_worker(int worker, int write_fd, char *script_names[], int num_script_names,
+    options_t *options) {
+
+    for (int i = worker; i < num_script_names; i += options->jobs) {
+        char *output = NULL, *samples = NULL;
+        size_t output_len = 0, samples_len = 0;
+        FILE *output_fp = open_memstream(&output, &output_len);
+        FILE *samples_fp = open_memstream(&samples, &samples_len);
+        if (output_fp == NULL || samples_fp == NULL) {
+            error(1, 0, "Libc heap exhausted. Cannot continue.");
+        }
+
+        FILE *saved_stdout = stdout;
+        stdout = output_fp;
+        options_t worker_options = *options;
+        if (options->samples_fp != NULL) {
+            worker_options.samples_fp = samples_fp;
+        }
+        int util = 0;
+        bool success = evaluate_script(script_names[i], &worker_options, &util);
+        stdout = saved_stdout;
+        fclose(output_fp);
+        fclose(samples_fp);
+
+        worker_result_t result = {.success = success, .util = util, 
+            .output_len = output_len, .samples_len = samples_len};
+        bool sent = write_all(write_fd, &result, sizeof(result)) &&
+            write_all(write_fd, output, output_len) &&
+            write_all(write_fd, samples, samples_len);
+        free(output);
+        free(samples);
+        if (!sent) {
+            break;
+        }
+    }
+    close(write_fd);
+}
+
+/* Function: write_all
+ * -------------------
+ * Writes len bytes to fd, retrying short writes. Returns false on error.
+ */
+static bool write_all(int fd, const void *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t nwritten = write(fd, buffer, len);
+        if (nwritten <= 0) {
+            return false;
+        }
+        buffer = (const char *)buffer + nwritten;
+        len -= nwritten;
+    }
+    return true;
+}
+
+/* Function: read_all
+ * ------------------
+ * Reads exactly len bytes from fd. Returns false on error or end of file.
+ */
+static bool read_all(int fd, void *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t nread = read(fd, buffer, len);
+        if (nread <= 0) {
+            return false;
+        }
+        buffer = (char *)buffer + nread;
+        len -= nread;
+    }
+    return true;
+}
+
+/* Function: evaluate_script
+ * -------------------------
+ * Parses and evaluates one script, printing its result line. Returns true
+ * on success, with the script's utilization percentage in *util.
+ */
+static bool evaluate_script(const char *script_name, options_t *options, int *util) {
+    script_t script = parse_script(script_name);
+
+    // Evaluate this script and record the results
+    printf("\nEvaluating allocator on %s...", script.name);
+    bool success;
+    if (options->counters) {
+        open_counters();
+    }
+    timing = false;
+    size_t used_segment = eval_correctness(&script, options, &success);
+    *util = 0;
+    if (success) {
+        printf("successfully serviced %d requests. (payload/segment = %zu/%zu)", 
+            script.num_ops, script.peak_size, used_segment);
+        if (used_segment > 0) {
+            *util = (100 * script.peak_size) / used_segment;
+        }
+        if (timing) {
+            printf("\n    after snapshot at request %d: %lu calls, %.1f ns/call",
+                options->snapshot_op, timed_calls, timed_calls ? (double)timed_ns / timed_calls : 0);
+        }
+        print_counters();
+        if (options->profile_period > 0) {
+            dump_profile(script_name);
+        }
+    }
+    timing = false;
+    close_counters();
+
+    free(script.ops);
+    free(script.blocks);
+    return success;
+}
+
 /* Function: eval_correctness
  * --------------------------
  * Check the allocator for correctness on given script. Interprets the
  * script operation-by-operation and reports if it detects any "obvious"
  * errors (returning blocks outside the heap, unaligned, 
- * overlapping blocks, etc.)
+ * overlapping blocks, etc.)  If the options ask for samples, a utilization
+ * sample is written every sample_interval requests and after the last one.
  */
-static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
+static size_t eval_correctness(script_t *script, options_t *options, bool *success) {
+    bool quiet = options->quiet;
+    FILE *samples_fp = options->samples_fp;
+    int sample_interval = options->sample_interval;
     *success = false;
     
     init_heap_segment(HEAP_SIZE);
@@ -178,6 +475,9 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
 
     // Send each request to the heap allocator and check the resulting behavior
     for (int req = 0; req < script->num_ops; req++) {
+        if (req == options->snapshot_op && !snapshot_and_restore(script, req)) {
+            return -1;
+        }
         int id = script->ops[req].id;
         size_t requested_size = script->ops[req].size;
 
@@ -214,7 +514,9 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
                 return -1;
             }
             script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+            counters_start();
             myfree(p);
+            counters_stop(FREE);
             cur_size -= old_size;
         }
 
@@ -228,6 +530,11 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
         if (cur_size > script->peak_size) {
             script->peak_size = cur_size;
         }
+
+        if (samples_fp != NULL && ((req + 1) % sample_interval == 0 ||
+            req + 1 == script->num_ops)) {
+            write_sample(samples_fp, script, req, heap_end, cur_size);
+        }
     }
 
     // verify payload is still intact for any block still allocated
@@ -242,6 +549,183 @@ static size_t eval_correctness(script_t *script, bool quiet, bool *success) {
     return (char *)heap_end - (char *)heap_segment_start();
 }
 
+/* Function: snapshot_and_restore
+ * -------------------------------
+ * Snapshots the heap before request req and restores it from the snapshot,
+ * so the rest of the script runs on a copy-on-write mapping as a test
+ * fixture would. Counter totals so far are discarded, and allocator calls
+ * are timed from here on. Returns false if either step fails.
+ */
+static bool snapshot_and_restore(script_t *script, int req) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/heap_snapshot.%d", (int)getpid());
+    bool restored = heap_snapshot(path) && heap_restore(path);
+    unlink(path);
+    if (!restored) {
+        allocator_error(script, script->ops[req].lineno, "heap snapshot or restore failed");
+        return false;
+    }
+
+    memset(request_totals, 0, sizeof(request_totals));
+    timed_ns = 0;
+    timed_calls = 0;
+    timing = true;
+    return true;
+}
+
+/* Function: dump_profile
+ * -----------------------
+ * Writes the heap profile of the script just run to the script's base
+ * name, with .prof in place of its extension, in the current directory.
+ */
+static void dump_profile(const char *script_name) {
+    char path[PATH_MAX];
+    char *name = strdup(script_name);
+    const char *base = name != NULL ? basename(name) : "heap";
+    const char *extension = strrchr(base, '.');
+    int base_len = extension != NULL ? (int)(extension - base) : (int)strlen(base);
+    snprintf(path, sizeof(path), "%.*s%s", base_len, base, PROFILE_SUFFIX);
+    free(name);
+
+    if (heap_profile_dump(path)) {
+        printf("\n    heap profile written to %s", path);
+    } else {
+        printf("\n    could not write heap profile to %s", path);
+    }
+}
+
+/* Function: write_sample
+ * -----------------------
+ * Writes one CSV row describing the heap after request req: the high-water
+ * mark of the heap as seen by the harness, the client's live bytes, and the
+ * allocator's view from heap_get_stats.  Utilization is the peak payload
+ * over the high-water mark so far, as reported at the end of a script.
+ * The external fragmentation index is 1 - largest free block / free bytes:
+ * 0 when all free memory is in one block, approaching 1 when it is
+ * scattered in pieces too small to serve a large request.
+ */
+static void write_sample(FILE *fp, script_t *script, int req, void *heap_end, size_t cur_size) {
+    heap_stats stats;
+    heap_get_stats(&stats);
+
+    size_t used_segment = (char *)heap_end - (char *)heap_segment_start();
+    double utilization = used_segment > 0 ? (double)script->peak_size / used_segment : 0;
+    double fragmentation = stats.free_bytes > 0 ? 
+        1 - (double)stats.largest_free_block / stats.free_bytes : 0;
+
+    fprintf(fp, "%s,%d,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%.4f,%.4f\n", script->name, req + 1,
+        used_segment, cur_size, script->peak_size, stats.heap_bytes, stats.free_blocks,
+        stats.free_bytes, stats.largest_free_block, utilization, fragmentation);
+}
+
+/* Function: open_counters
+ * -------------------------
+ * Opens the perf counter group for the next script and clears the per
+ * request type totals. If perf is unavailable this says so once, and
+ * the script runs unmeasured.
+ */
+static void open_counters(void) {
+    static bool warned = false;
+    memset(request_totals, 0, sizeof(request_totals));
+    counting = perf_counters_open(&counters);
+    if (!counting && !warned) {
+        printf("(perf counters unavailable: %s; continuing without them)", strerror(errno));
+        warned = true;
+    }
+}
+
+/* Function: close_counters
+ * ------------------------
+ * Closes the perf counter group, if open.
+ */
+static void close_counters(void) {
+    if (counting) {
+        perf_counters_close(&counters);
+        counting = false;
+    }
+}
+
+/* Function: counters_start
+ * ------------------------
+ * Lets the counters, and the clock when timing, run for the allocator call
+ * that follows.
+ */
+static void counters_start(void) {
+    if (timing) {
+        clock_gettime(CLOCK_MONOTONIC, &call_start);
+    }
+    if (counting) {
+        perf_counters_start(&counters);
+    }
+}
+
+/* Function: counters_stop
+ * -----------------------
+ * Stops the counters after an allocator call, charging the call to its
+ * request type.
+ */
+static void counters_stop(enum request_type op) {
+    if (counting) {
+        perf_counters_stop(&counters, &request_totals[op]);
+    }
+    if (timing) {
+        struct timespec call_end;
+        clock_gettime(CLOCK_MONOTONIC, &call_end);
+        timed_ns += (call_end.tv_sec - call_start.tv_sec) * 1000000000L +
+            (call_end.tv_nsec - call_start.tv_nsec);
+        timed_calls++;
+    }
+}
+
+/* Function: print_counters
+ * ------------------------
+ * Prints, per request type, the number of calls and the average of each
+ * counted event per call, followed by the totals for the script. Counts
+ * are scaled if the group was multiplexed, and shown as n/a if it never
+ * ran.
+ */
+static void print_counters(void) {
+    if (!counting) {
+        return;
+    }
+    printf("\n    %-8s %9s", "request", "calls");
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        printf(" %14s", perf_event_name(e));
+    }
+
+    perf_totals all = {.calls = 0};
+    enum request_type ops[] = {ALLOC, REALLOC, FREE};
+    for (int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        perf_totals *totals = &request_totals[ops[i]];
+        all.calls += totals->calls;
+        all.time_enabled += totals->time_enabled;
+        all.time_running += totals->time_running;
+        printf("\n    %-8s %9lu", REQUEST_NAMES[ops[i]], totals->calls);
+        for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+            all.values[e] += totals->values[e];
+            double value;
+            if (!perf_counters_available(&counters, e) || !perf_totals_value(totals, e, &value)) {
+                printf(" %14s", "n/a");
+            } else {
+                printf(" %14.1f", totals->calls ? value / totals->calls : 0);
+            }
+        }
+    }
+    printf("\n    %-8s %9lu", "total", all.calls);
+    for (int e = 0; e < PERF_NUM_EVENTS; e++) {
+        double value;
+        if (!perf_counters_available(&counters, e) || !perf_totals_value(&all, e, &value)) {
+            printf(" %14s", "n/a");
+        } else {
+            printf(" %14.0f", value);
+        }
+    }
+    if (all.time_running > 0 && all.time_running < all.time_enabled) {
+        printf("\n    (counters multiplexed: ran %.0f%% of the time, counts scaled)",
+            100.0 * all.time_running / all.time_enabled);
+    }
+}
+
 /* Function: eval_malloc
  * ---------------------
  * Performs a test of a call to mymalloc of the given size.  The req number
@@ -258,7 +742,10 @@ static void *eval_malloc(int req, size_t requested_size, script_t *script,
     int id = script->ops[req].id;
 
     void *p;
-    if ((p = mymalloc(requested_size)) == NULL && requested_size != 0) {
+    counters_start();
+    p = mymalloc(requested_size);
+    counters_stop(ALLOC);
+    if (p == NULL && requested_size != 0) {
         allocator_error(script, script->ops[req].lineno, 
             "heap exhausted, malloc returned NULL");
         *failptr = true;
@@ -306,7 +793,10 @@ static void *eval_realloc(int req, size_t requested_size, script_t *script,
     }
 
     void *newp;
-    if ((newp = myrealloc(oldp, requested_size)) == NULL && requested_size != 0) {
+    counters_start();
+    newp = myrealloc(oldp, requested_size);
+    counters_stop(REALLOC);
+    if (newp == NULL && requested_size != 0) {
         allocator_error(script, script->ops[req].lineno, 
             "heap exhausted, realloc returned NULL");
         *failptr = true;
@@ -418,131 +908,3 @@ static void allocator_error(script_t *script, int lineno, char* format, ...) {
     va_end(args);
     fprintf(stdout,"\n");
 }
-
-
-/* SCRIPT PARSING IMPLEMENTATION */
-
-
-/* Fuction: parse_script
- * ---------------------
- * This function parses the script file at the specified path, and returns an
- * object with info about it.  It expects one request per line, and adds each
- * request's information to the ops array within the script.  This function
- * throws an error if the file can't be opened, if a line is malformed, or if
- * the file is too long to store each request on the heap.
- */
-static script_t parse_script(const char *path) {
-    FILE *fp = fopen(path, "r");
-    if (fp == NULL) {
-        error(1, 0, "Could not open script file \"%s\".", path);
-    }
-
-    // Initialize a script object to store the information about this script
-    script_t script = { .ops = NULL, .blocks = NULL, .num_ops = 0, .peak_size = 0};
-    const char *basename = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
-    strncpy(script.name, basename, sizeof(script.name) - 1);
-    script.name[sizeof(script.name) - 1] = '\0';
-
-    int lineno = 0;
-    int nallocated = 0;
-    int maxid = 0;
-    char buffer[MAX_SCRIPT_LINE_LEN];
-
-    for (int i = 0; read_line(buffer, sizeof(buffer), fp, &lineno); i++) {
-
-        // Resize script->ops if we need more space for lines
-        if (i == nallocated) {
-            nallocated += OPS_RESIZE_AMOUNT;
-            void *new_memory = realloc(script.ops, 
-                nallocated * sizeof(request_t));
-            if (!new_memory) {
-                free(script.ops);
-                error(1, 0, "Libc heap exhausted. Cannot continue.");
-            }
-            script.ops = new_memory;
-        }
-
-        script.ops[i] = parse_script_line(buffer, i, lineno, script.name);
-
-        if (script.ops[i].id > maxid) {
-            maxid = script.ops[i].id;
-        }
-
-        script.num_ops = i + 1;
-    }
-
-    fclose(fp);
-    script.num_ids = maxid + 1;
-
-    script.blocks = calloc(script.num_ids, sizeof(block_t));
-    if (!script.blocks) {
-        error(1, 0, "Libc heap exhausted. Cannot continue.");
-    }
-
-    return script;
-}
-
-/* Function: read_line
- * --------------------
- * This function reads one line from the specified file and stores at most
- * buffer_size characters from it in buffer, removing any trailing newline.
- * It skips lines that are all-whitespace or that contain comments (begin with
- * # as first non-whitespace character).  When reading a line, it increments the
- * counter pointed to by `pnread` once for each line read/skipped. This function
- * returns true if did read a valid line eventually, or false otherwise.
- */
-static bool read_line(char buffer[], size_t buffer_size, FILE *fp, 
-    int *pnread) {
-
-    while (true) {
-        if (fgets(buffer, buffer_size, fp) == NULL) {
-            return false;
-        }
-
-        (*pnread)++;
-
-        // remove any trailing newline
-        if (buffer[strlen(buffer)-1] == '\n') {
-            buffer[strlen(buffer)-1] ='\0'; 
-        }
-
-        /* Stop only if this line is not a comment line (comment lines start
-         * with # as first non-whitespace character)
-         */
-        char ch;
-        if (sscanf(buffer, " %c", &ch) == 1 && ch != '#') {
-            return true;
-        }
-    }
-}
-
-/* Function: parse_script_line
- * ---------------------------
- * This function parses the provided line from the script and returns info
- * about it as a request_t object filled in with the type of the request,
- * the size, the ID, and the line number.  If the line is malformed, this
- * function throws an error.
- */
-static request_t parse_script_line(char *buffer, int i, int lineno, 
-    char *script_name) {
-
-    request_t request = { .lineno = lineno, .op = 0, .size = 0};
-
-    char request_char;
-    int nscanned = sscanf(buffer, " %c %d %zu", &request_char, 
-        &request.id, &request.size);
-    if (request_char == 'a' && nscanned == 3) {
-        request.op = ALLOC;
-    } else if (request_char == 'r' && nscanned == 3) {
-        request.op = REALLOC;
-    } else if (request_char == 'f' && nscanned == 2) {
-        request.op = FREE;
-    }
-
-    if (!request.op || request.id < 0 || request.size > MAX_REQUEST_SIZE) {
-        error(1, 0, "Line %d of script file '%s' is malformed.", 
-            lineno, script_name);
-    }
-
-    return request;
-}
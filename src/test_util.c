@@ -0,0 +1,86 @@
+/* File: test_util.c
+ * -----------------
+ * Helpers shared by the check programs; see test_util.h.
+ */
+
+#include "test_util.h"
+#include <error.h>
+#include <stdio.h>
+#include <string.h>
+#include "allocator.h"
+#include "segment.h"
+
+
+int run_checks(const check_t *checks, int nchecks, char *names[], int nnames) {
+    int nrun = 0, nfailures = 0;
+    for (int i = 0; i < nchecks; i++) {
+        bool selected = nnames == 0;
+        for (int j = 0; j < nnames; j++) {
+            selected = selected || strcmp(names[j], checks[i].name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        printf("Checking %s...", checks[i].name);
+        if (reset_heap() && checks[i].check() && validate_heap()) {
+            printf("ok\n");
+        } else {
+            printf("FAILED\n");
+            nfailures++;
+        }
+        nrun++;
+    }
+    if (nrun == 0) {
+        error(1, 0, "No check by that name.");
+    }
+    if (nfailures == 0) {
+        printf("\nsuccessfully passed %d checks\n", nrun);
+    }
+    return nfailures;
+}
+
+bool reset_heap(void) {
+    init_heap_segment(TEST_HEAP_SIZE);
+    return myinit(heap_segment_start(), heap_segment_size());
+}
+
+void fill(void *ptr, size_t size, int pattern) {
+    memset(ptr, pattern & 0xFF, size);
+}
+
+bool intact(const void *ptr, size_t size, int pattern) {
+    for (size_t i = 0; i < size; i++) {
+        if (((const unsigned char *)ptr)[i] != (pattern & 0xFF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void mutate_blocks(test_blocks *blocks, int round) {
+    for (int i = 0; i < TEST_BLOCKS; i++) {
+        if (blocks->ptrs[i] == NULL) {
+            blocks->sizes[i] = 16 + 24 * ((i + round) % 11);
+            blocks->ptrs[i] = mymalloc(blocks->sizes[i]);
+        } else if ((i + round) % 3 == 0) {
+            myfree(blocks->ptrs[i]);
+            blocks->ptrs[i] = NULL;
+            continue;
+        } else if ((i + round) % 4 == 0) {
+            blocks->sizes[i] += 100;
+            blocks->ptrs[i] = myrealloc(blocks->ptrs[i], blocks->sizes[i]);
+        }
+        blocks->patterns[i] = i * 7 + round + 1;
+        fill(blocks->ptrs[i], blocks->sizes[i], blocks->patterns[i]);
+    }
+}
+
+bool verify_blocks(const test_blocks *blocks) {
+    for (int i = 0; i < TEST_BLOCKS; i++) {
+        if (blocks->ptrs[i] != NULL &&
+            !intact(blocks->ptrs[i], blocks->sizes[i], blocks->patterns[i])) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,84 @@
+/* File: test_util.h
+ * -----------------
+ * Helpers shared by the check programs (heap_test.c, region_test.c,
+ * snapshot_test.c), which exercise interfaces scripts cannot: a table of
+ * named checks run each on a fresh heap, and sets of blocks that are
+ * allocated, freed and grown round by round, each filled with a pattern
+ * particular to the block and round so that a clobbered or lost block is
+ * found.
+ */
+
+#ifndef _TEST_UTIL_H_
+#define _TEST_UTIL_H_
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+// size of the segment each check starts on
+#define TEST_HEAP_SIZE (1L << 32)
+
+// blocks in a block set
+#define TEST_BLOCKS 64
+
+
+/* Type: check_t
+ * -------------
+ * A named check, true if it passed.
+ */
+typedef struct {
+    const char *name;
+    bool (*check)(void);
+} check_t;
+
+
+/* Type: test_blocks
+ * -----------------
+ * A set of blocks and the pattern each holds. It holds no pointers but
+ * its blocks, so it can itself live in a heap, e.g. as the root block of
+ * a persistent one.
+ */
+typedef struct {
+    void *ptrs[TEST_BLOCKS];        // NULL once freed
+    size_t sizes[TEST_BLOCKS];
+    int patterns[TEST_BLOCKS];
+} test_blocks;
+
+
+/* Function: run_checks
+ * --------------------
+ * Runs the checks named in names, or all of them if there are none, each
+ * on a fresh heap that must validate afterwards. Prints the outcome of
+ * each, and a summary if all passed. Returns the number of failed checks;
+ * exits if no check has a name asked for.
+ */
+int run_checks(const check_t *checks, int nchecks, char *names[], int nnames);
+
+
+/* Function: reset_heap
+ * --------------------
+ * Gives the allocator a fresh segment of TEST_HEAP_SIZE bytes. Returns
+ * whether myinit succeeded.
+ */
+bool reset_heap(void);
+
+
+/* Functions: fill, intact
+ * -----------------------
+ * fill writes a pattern byte derived from pattern over size bytes at ptr;
+ * intact returns whether they still hold it.
+ */
+void fill(void *ptr, size_t size, int pattern);
+bool intact(const void *ptr, size_t size, int pattern);
+
+
+/* Functions: mutate_blocks, verify_blocks
+ * ---------------------------------------
+ * mutate_blocks allocates the blocks missing from the set, then frees some
+ * and grows others, a different share in each round, filling each block
+ * it keeps with its pattern for the round. verify_blocks returns whether
+ * every block in the set holds its pattern.
+ */
+void mutate_blocks(test_blocks *blocks, int round);
+bool verify_blocks(const test_blocks *blocks);
+
+
+#endif
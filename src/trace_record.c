@@ -0,0 +1,386 @@
+/* File: trace_record.c
+ * --------------------
+ * Records allocator calls from a live program as a harness script.
+ *
+ * Each thread logs its events into its own ring buffer, so the allocation
+ * path never takes a lock: the thread fills a slot and publishes it with a
+ * release store of the ring tail. Events are stamped with a global sequence
+ * number. A background writer thread drains the rings in sequence order,
+ * maps each pointer to a stable id, and writes the script lines. Ids of
+ * freed blocks are reused, so the script needs as many ids as the peak
+ * number of live blocks. If a ring is full the thread waits for the writer
+ * rather than dropping events, as a dropped free would corrupt the script.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "trace_record.h"
+
+#define RING_SLOTS          65536       // must be a power of 2
+#define WRITER_SLEEP_NS     1000000     // writer idle poll, 1ms
+#define ID_MAP_MIN_SLOTS    1024
+
+enum trace_op {
+    TRACE_ALLOC,
+    TRACE_REALLOC,
+    TRACE_FREE
+};
+
+typedef struct {
+    unsigned long seq;      // global order of the event
+    enum trace_op op;
+    void *ptr;              // block returned (alloc, realloc) or freed
+    void *old_ptr;          // block resized (realloc)
+    size_t size;
+} trace_event;
+
+// single producer (owning thread), single consumer (writer thread)
+typedef struct trace_ring {
+    trace_event events[RING_SLOTS];
+    _Atomic size_t head;    // next slot the writer reads
+    _Atomic size_t tail;    // next slot the thread fills
+    struct trace_ring *next;
+} trace_ring;
+
+// writer-side map from live pointer to script id
+typedef struct {
+    void *ptr;              // NULL if the slot is empty
+    int id;
+} id_slot;
+
+static _Atomic bool recording = false;
+static _Atomic bool stopping = false;
+static _Atomic unsigned long next_seq = 0;
+static _Atomic(trace_ring *) rings = NULL;
+
+static __thread trace_ring *thread_ring = NULL;
+static __thread int suppress_depth = 0;
+
+static pthread_t writer_thread;
+static FILE *trace_fp = NULL;
+
+// writer thread state
+static unsigned long write_seq = 0;
+static id_slot *id_map = NULL;
+static size_t id_map_slots = 0;
+static size_t id_map_count = 0;
+static int *free_ids = NULL;
+static size_t free_ids_count = 0;
+static size_t free_ids_capacity = 0;
+static int num_ids = 0;
+
+
+/* RECORDING (ALLOCATING THREADS) */
+
+
+/* Function: get_thread_ring
+ * -------------------------
+ * Returns the calling thread's ring, creating and publishing it on the
+ * shared list on first use, or NULL if it could not be allocated.
+ */
+static trace_ring *get_thread_ring() {
+    if (thread_ring == NULL) {
+        trace_ring *ring = calloc(1, sizeof(trace_ring));
+        if (ring == NULL) {
+            return NULL;
+        }
+        ring->next = atomic_load(&rings);
+        while (!atomic_compare_exchange_weak(&rings, &ring->next, ring)) {}
+        thread_ring = ring;
+    }
+    return thread_ring;
+}
+
+/* Function: record_event
+ * ----------------------
+ * Appends an event to the calling thread's ring.
+ */
+static void record_event(enum trace_op op, void *ptr, void *old_ptr, size_t size) {
+    if (!atomic_load_explicit(&recording, memory_order_relaxed) || suppress_depth > 0) {
+        return;
+    }
+    trace_ring *ring = get_thread_ring();
+    if (ring == NULL) {
+        return;
+    }
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == RING_SLOTS) {
+        sched_yield();
+    }
+    ring->events[tail & (RING_SLOTS - 1)] = (trace_event){
+        .seq = atomic_fetch_add_explicit(&next_seq, 1, memory_order_relaxed),
+        .op = op, .ptr = ptr, .old_ptr = old_ptr, .size = size};
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+void trace_record_malloc(void *ptr, size_t size) {
+    if (ptr != NULL) {
+        record_event(TRACE_ALLOC, ptr, NULL, size);
+    }
+}
+
+void trace_record_free(void *ptr) {
+    if (ptr != NULL) {
+        record_event(TRACE_FREE, ptr, NULL, 0);
+    }
+}
+
+void trace_record_realloc_begin(void) {
+    suppress_depth++;
+}
+
+void trace_record_realloc_end(void *old_ptr, void *new_ptr, size_t size) {
+    suppress_depth--;
+    if (new_ptr == NULL) {
+        return;
+    }
+    if (old_ptr == NULL) {
+        record_event(TRACE_ALLOC, new_ptr, NULL, size);
+    } else {
+        record_event(TRACE_REALLOC, new_ptr, old_ptr, size);
+    }
+}
+
+
+/* WRITING (WRITER THREAD) */
+
+
+/* Function: id_map_find
+ * ---------------------
+ * Returns the id map slot holding ptr, or the empty slot where it belongs.
+ */
+static id_slot *id_map_find(void *ptr) {
+    uint64_t h = (uintptr_t)ptr;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    for (size_t i = h & (id_map_slots - 1); ; i = (i + 1) & (id_map_slots - 1)) {
+        if (id_map[i].ptr == NULL || id_map[i].ptr == ptr) {
+            return &id_map[i];
+        }
+    }
+}
+
+/* Function: id_map_grow
+ * ---------------------
+ * Doubles the id map, rehashing every live pointer. Returns false if
+ * memory ran out.
+ */
+static bool id_map_grow() {
+    id_slot *old_map = id_map;
+    size_t old_slots = id_map_slots;
+    size_t new_slots = old_slots ? old_slots * 2 : ID_MAP_MIN_SLOTS;
+    id_slot *new_map = calloc(new_slots, sizeof(id_slot));
+    if (new_map == NULL) {
+        return false;
+    }
+    id_map = new_map;
+    id_map_slots = new_slots;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old_map[i].ptr != NULL) {
+            *id_map_find(old_map[i].ptr) = old_map[i];
+        }
+    }
+    free(old_map);
+    return true;
+}
+
+/* Function: id_map_remove
+ * -----------------------
+ * Removes a slot from the id map, shifting back later entries of its probe
+ * run so lookups never stop early.
+ */
+static void id_map_remove(id_slot *slot) {
+    size_t i = slot - id_map;
+    id_map[i].ptr = NULL;
+    for (size_t j = (i + 1) & (id_map_slots - 1); id_map[j].ptr != NULL;
+         j = (j + 1) & (id_map_slots - 1)) {
+        id_slot moved = id_map[j];
+        id_map[j].ptr = NULL;
+        *id_map_find(moved.ptr) = moved;
+    }
+    id_map_count--;
+}
+
+/* Function: assign_id
+ * -------------------
+ * Maps a newly allocated pointer to an id, reusing a freed id if any.
+ * Returns -1 if memory ran out.
+ */
+static int assign_id(void *ptr) {
+    if ((id_map_count + 1) * 2 > id_map_slots && !id_map_grow()) {
+        return -1;
+    }
+    id_slot *slot = id_map_find(ptr);
+    if (slot->ptr == NULL) {
+        id_map_count++;
+    }
+    slot->ptr = ptr;
+    slot->id = free_ids_count > 0 ? free_ids[--free_ids_count] : num_ids++;
+    return slot->id;
+}
+
+/* Function: release_id
+ * --------------------
+ * Unmaps a freed pointer and returns its id, or -1 if the pointer was
+ * never recorded (e.g. allocated before recording started).
+ */
+static int release_id(void *ptr) {
+    if (id_map_slots == 0) {
+        return -1;
+    }
+    id_slot *slot = id_map_find(ptr);
+    if (slot->ptr == NULL) {
+        return -1;
+    }
+    int id = slot->id;
+    id_map_remove(slot);
+
+    if (free_ids_count == free_ids_capacity) {
+        size_t capacity = free_ids_capacity ? free_ids_capacity * 2 : ID_MAP_MIN_SLOTS;
+        int *new_ids = realloc(free_ids, capacity * sizeof(int));
+        if (new_ids == NULL) {
+            return id;
+        }
+        free_ids = new_ids;
+        free_ids_capacity = capacity;
+    }
+    free_ids[free_ids_count++] = id;
+    return id;
+}
+
+/* Function: write_event
+ * ---------------------
+ * Translates one event into a script line.
+ */
+static void write_event(const trace_event *event) {
+    int id;
+    switch (event->op) {
+        case TRACE_ALLOC:
+            if ((id = assign_id(event->ptr)) >= 0) {
+                fprintf(trace_fp, "a %d %zu\n", id, event->size);
+            }
+            break;
+        case TRACE_REALLOC:
+            if (id_map_slots == 0 || id_map_find(event->old_ptr)->ptr == NULL) {
+                // resized block was allocated before recording started
+                if ((id = assign_id(event->ptr)) >= 0) {
+                    fprintf(trace_fp, "a %d %zu\n", id, event->size);
+                }
+                break;
+            }
+            id_slot *slot = id_map_find(event->old_ptr);
+            id = slot->id;
+            if (event->ptr != event->old_ptr) {
+                id_map_remove(slot);
+                if ((id_map_count + 1) * 2 > id_map_slots && !id_map_grow()) {
+                    break;
+                }
+                slot = id_map_find(event->ptr);
+                if (slot->ptr == NULL) {
+                    id_map_count++;
+                }
+                *slot = (id_slot){.ptr = event->ptr, .id = id};
+            }
+            fprintf(trace_fp, "r %d %zu\n", id, event->size);
+            break;
+        case TRACE_FREE:
+            if ((id = release_id(event->ptr)) >= 0) {
+                fprintf(trace_fp, "f %d\n", id);
+            }
+            break;
+    }
+}
+
+/* Function: drain_rings
+ * ---------------------
+ * Writes published events in sequence order until the next one in order
+ * is not yet visible. Returns the number of events written.
+ */
+static size_t drain_rings() {
+    size_t nwritten = 0;
+    while (true) {
+        trace_ring *found = NULL;
+        for (trace_ring *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+            size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            if (head != atomic_load_explicit(&ring->tail, memory_order_acquire) &&
+                ring->events[head & (RING_SLOTS - 1)].seq == write_seq) {
+                found = ring;
+                break;
+            }
+        }
+        if (found == NULL) {
+            return nwritten;
+        }
+        size_t head = atomic_load_explicit(&found->head, memory_order_relaxed);
+        write_event(&found->events[head & (RING_SLOTS - 1)]);
+        atomic_store_explicit(&found->head, head + 1, memory_order_release);
+        write_seq++;
+        nwritten++;
+    }
+}
+
+/* Function: writer_main
+ * ---------------------
+ * Background thread: drains the rings until asked to stop, then performs
+ * a final drain.
+ */
+static void *writer_main(void *arg) {
+    struct timespec idle = {.tv_sec = 0, .tv_nsec = WRITER_SLEEP_NS};
+    while (!atomic_load(&stopping)) {
+        if (drain_rings() == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    while (write_seq < atomic_load(&next_seq)) {
+        drain_rings();
+    }
+    return NULL;
+}
+
+
+/* LIFECYCLE */
+
+
+bool trace_record_start(const char *path) {
+    if (atomic_load(&recording)) {
+        return false;
+    }
+    trace_fp = fopen(path, "w");
+    if (trace_fp == NULL) {
+        return false;
+    }
+    fprintf(trace_fp, "# Trace recorded from a live program\n");
+    atomic_store(&stopping, false);
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        fclose(trace_fp);
+        trace_fp = NULL;
+        return false;
+    }
+    atomic_store(&recording, true);
+    return true;
+}
+
+void trace_record_start_from_env(void) {
+    const char *path = getenv("HEAP_TRACE");
+    if (path != NULL && !atomic_load(&recording) && trace_record_start(path)) {
+        atexit(trace_record_stop);
+    }
+}
+
+void trace_record_stop(void) {
+    if (!atomic_load(&recording)) {
+        return;
+    }
+    atomic_store(&recording, false);
+    atomic_store(&stopping, true);
+    pthread_join(writer_thread, NULL);
+    fclose(trace_fp);
+    trace_fp = NULL;
+}
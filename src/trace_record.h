@@ -0,0 +1,67 @@
+/* File: trace_record.h
+ * --------------------
+ * Interface to the allocation trace recorder. When an allocator is compiled
+ * with -DTRACE_RECORD and the program runs with HEAP_TRACE=path in its
+ * environment, every malloc, realloc and free is logged and written to path
+ * as a script the test harness can replay:
+ *      a id size / r id size / f id
+ * Without TRACE_RECORD the TRACE_* hooks compile to nothing.
+ */
+
+#ifndef _TRACE_RECORD_H_
+#define _TRACE_RECORD_H_
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+
+/* Function: trace_record_start
+ * ----------------------------
+ * Starts recording to the script file at path, and the background thread
+ * that writes it. Returns false if recording could not be started.
+ */
+bool trace_record_start(const char *path);
+
+
+/* Function: trace_record_start_from_env
+ * -------------------------------------
+ * Starts recording to the path named by HEAP_TRACE, if set and not already
+ * recording, and arranges for trace_record_stop to run at exit.
+ */
+void trace_record_start_from_env(void);
+
+
+/* Function: trace_record_stop
+ * ---------------------------
+ * Flushes all pending events, stops the writer thread and closes the file.
+ */
+void trace_record_stop(void);
+
+
+/* Functions: trace_record_malloc, trace_record_free, trace_record_realloc_*
+ * ------------------------------------------------------------------------
+ * Allocator hooks. Calls made between trace_record_realloc_begin and
+ * trace_record_realloc_end on the same thread are not recorded, so a realloc
+ * that falls back to malloc/free is logged as a single realloc.
+ */
+void trace_record_malloc(void *ptr, size_t size);
+void trace_record_free(void *ptr);
+void trace_record_realloc_begin(void);
+void trace_record_realloc_end(void *old_ptr, void *new_ptr, size_t size);
+
+
+#ifdef TRACE_RECORD
+#define TRACE_INIT()                        trace_record_start_from_env()
+#define TRACE_MALLOC(ptr, size)             trace_record_malloc(ptr, size)
+#define TRACE_FREE(ptr)                     trace_record_free(ptr)
+#define TRACE_REALLOC_BEGIN()               trace_record_realloc_begin()
+#define TRACE_REALLOC_END(old, ptr, size)   trace_record_realloc_end(old, ptr, size)
+#else
+#define TRACE_INIT()
+#define TRACE_MALLOC(ptr, size)
+#define TRACE_FREE(ptr)
+#define TRACE_REALLOC_BEGIN()
+#define TRACE_REALLOC_END(old, ptr, size)
+#endif
+
+
+#endif